@@ -0,0 +1,623 @@
+#include "utree.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "concurrentutree.h"
+#include "shardedutree.h"
+#include "frozenutree.h"
+#include "prefixindex.h"
+#include "exportsink.h"
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+
+#define BUCKET 1000
+#define NUMDISCS (MAX_DISC - MIN_DISC + 1)
+#define NUMNAMES 20000
+#define NUMRELOAD 200000
+#define BENCH_CSV "bench_accounts.csv"
+#define BENCH_SNAPSHOT "bench_accounts.snap"
+#define BENCH_JOURNAL "bench_accounts.log"
+#define NUMJOURNALED 20000
+#define READ_MILLIS 500
+#define NUMSHARDEDOPS 200000
+#define NUMREMOVENAMES 1000000
+#define NUMREMOVED 200000
+#define BATCH_SIZE 10000
+#define NUMBATCHES 20
+#define NUMFROZEN 2000000
+#define NUMFROZENNAMES 500000
+#define NUMSMALLTREES 50000
+#define NUMSMALLLOOKUPS 5000000
+#define NUMPREFIXNAMES 2000000
+#define NUMPREFIXQUERIES 200000
+#define PREFIX_LIMIT 10
+#define NUMSCANNED 2000000
+#define NUMEXPORTED 2000000
+#define BENCH_EXPORT "bench_export.out"
+
+std::mt19937 rng(10);
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Grows one DTree to every possible discriminator in random order and
+ * reports the average cost of an insert for each bucket of 1000 inserts.
+ * The cost per insert should stay flat as the tree grows.
+**/
+void benchDTreeInsert() {
+    std::vector<int> discs;
+    for(int disc = MIN_DISC; disc <= MAX_DISC; disc++) discs.push_back(disc);
+    std::shuffle(discs.begin(), discs.end(), rng);
+
+    DTree dtree;
+    cout << "DTree insert, ns/insert per " << BUCKET << " inserts:" << endl;
+    for(int i = 0; i < NUMDISCS; i += BUCKET) {
+        auto start = Clock::now();
+        for(int j = i; j < i + BUCKET && j < NUMDISCS; j++) {
+            dtree.insert(Account("bench", discs[j], 0, "", ""));
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        cout << "\t" << i + BUCKET << " accounts: " << ns / BUCKET << " ns" << endl;
+    }
+}
+
+/**
+ * Random accounts spread over NUMNAMES usernames.
+**/
+std::vector<Account> makeAccounts(int count) {
+    std::uniform_int_distribution<> distName(0, NUMNAMES - 1);
+    std::uniform_int_distribution<> distDisc(MIN_DISC, MAX_DISC);
+    std::vector<Account> accts;
+    accts.reserve(count);
+    for(int i = 0; i < count; i++) {
+        accts.push_back(Account("user" + std::to_string(distName(rng)), distDisc(rng), i % 2, "", ""));
+    }
+    return accts;
+}
+
+/**
+ * Repeatedly fills a UTree and clears it again, the way a full reload does.
+**/
+void benchUTreeReload() {
+    std::vector<Account> accts = makeAccounts(NUMRELOAD);
+    UTree utree;
+    cout << "UTree reload of " << NUMRELOAD << " accounts:" << endl;
+    for(int round = 0; round < 3; round++) {
+        auto start = Clock::now();
+        for(const Account& acct : accts) utree.insert(acct);
+        auto mid = Clock::now();
+        utree.clear();
+        auto end = Clock::now();
+        cout << "\tinsert " << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / NUMRELOAD
+             << " ns/account, clear " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / NUMRELOAD
+             << " ns/account" << endl;
+    }
+}
+
+/**
+ * Looks up every loaded account by username and discriminator.
+**/
+void benchUTreeRetrieve() {
+    std::vector<Account> accts = makeAccounts(NUMRELOAD);
+    UTree utree;
+    for(const Account& acct : accts) utree.insert(acct);
+    std::shuffle(accts.begin(), accts.end(), rng);
+
+    int found = 0;
+    auto start = Clock::now();
+    for(const Account& acct : accts) {
+        if(utree.retrieveUser(acct.getUsername(), acct.getDiscriminator()) != nullptr) found++;
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    cout << "UTree retrieveUser: " << ns / NUMRELOAD << " ns/lookup (" << found << " found)" << endl;
+}
+
+/**
+ * Times one loader filling a fresh UTree from path.
+**/
+template <class Load>
+void timeLoad(const string& name, Load load, double megabytes) {
+    UTree utree;
+    auto start = Clock::now();
+    load(utree);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    cout << "\t" << name << ": " << seconds * 1000 << " ms, " << megabytes / seconds << " MB/s" << endl;
+}
+
+/**
+ * Writes NUMRELOAD random accounts to a .csv file and loads it with each
+ * loader, once in random order and once sorted by (username, disc).
+**/
+void benchLoaders() {
+    std::vector<Account> accts = makeAccounts(NUMRELOAD);
+    for(int pass = 0; pass < 2; pass++) {
+        if(pass == 1) {
+            std::sort(accts.begin(), accts.end(), [](const Account& a, const Account& b) {
+                return a.getUsername() < b.getUsername()
+                    || (a.getUsername() == b.getUsername() && a.getDiscriminator() < b.getDiscriminator());
+            });
+        }
+        {
+            std::ofstream out(BENCH_CSV);
+            for(const Account& acct : accts) {
+                out << acct.getUsername() << ',' << acct.getDiscriminator() << ',' << acct.hasNitro()
+                    << ",Subscriber,This is a status\n";
+            }
+        }
+        std::ifstream in(BENCH_CSV, std::ios::ate | std::ios::binary);
+        double megabytes = in.tellg() / 1e6;
+        cout << "Loading " << NUMRELOAD << (pass == 0 ? " random" : " sorted") << " accounts (" << megabytes << " MB):" << endl;
+        timeLoad("loadData", [](UTree& utree) {utree.loadData(BENCH_CSV);}, megabytes);
+        timeLoad("loadMapped", [](UTree& utree) {utree.loadMapped(BENCH_CSV);}, megabytes);
+        for(int threads = 1; threads <= 16; threads *= 2) {
+            timeLoad("loadParallel x" + std::to_string(threads),
+                     [threads](UTree& utree) {utree.loadParallel(BENCH_CSV, true, threads);}, megabytes);
+        }
+    }
+    std::remove(BENCH_CSV);
+}
+
+/**
+ * Saves a loaded UTree as a snapshot and times restoring it, next to
+ * reloading the same accounts from .csv.
+**/
+void benchSnapshot() {
+    std::vector<Account> accts = makeAccounts(NUMRELOAD);
+    UTree utree;
+    for(const Account& acct : accts) utree.insert(acct);
+
+    auto start = Clock::now();
+    utree.saveSnapshot(BENCH_SNAPSHOT);
+    double saveMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    UTree restored;
+    start = Clock::now();
+    restored.loadSnapshot(BENCH_SNAPSHOT);
+    double loadMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    start = Clock::now();
+    SnapshotView view(BENCH_SNAPSHOT);
+    int found = 0;
+    for(const Account& acct : accts) found += view.numUsers(acct.getUsername()) > 0;
+    double viewMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    cout << "Snapshot of " << NUMRELOAD << " accounts: save " << saveMs << " ms, restore " << loadMs
+         << " ms, mapped view open + " << found << " lookups " << viewMs << " ms" << endl;
+    std::remove(BENCH_SNAPSHOT);
+}
+
+/**
+ * Cost of an insert with the journal attached, for a few group sizes.
+**/
+void benchJournal() {
+    std::vector<Account> accts = makeAccounts(NUMJOURNALED);
+    cout << "Journaled inserts (" << NUMJOURNALED << "):" << endl;
+    for(int groupSize : {0, 1, 16, 256}) {
+        std::remove(BENCH_JOURNAL);
+        UTree utree;
+        Journal* journal = (groupSize > 0 ? new Journal(BENCH_JOURNAL, groupSize) : nullptr);
+        utree.setJournal(journal);
+        auto start = Clock::now();
+        for(const Account& acct : accts) utree.insert(acct);
+        if(journal != nullptr) journal->sync();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        cout << "\t" << (groupSize > 0 ? "group of " + std::to_string(groupSize) : string("no journal"))
+             << ": " << ns / NUMJOURNALED << " ns/insert" << endl;
+        utree.setJournal(nullptr);
+        delete journal;
+    }
+    std::remove(BENCH_JOURNAL);
+}
+
+/**
+ * Read throughput of a ConcurrentUTree for growing numbers of reader
+ * threads, while one writer keeps inserting and removing accounts.
+**/
+void benchConcurrentReads() {
+    std::vector<Account> accts = makeAccounts(NUMRELOAD);
+    ConcurrentUTree ctree;
+    ctree.write([&](UTree& utree) {for(const Account& acct : accts) utree.insert(acct);});
+    ctree.insert(Account("bench_writer", MAX_DISC, 0, "", ""));
+
+    cout << "ConcurrentUTree reads with one writer (" << std::thread::hardware_concurrency() << " cores):" << endl;
+    for(int threads : {1, 2, 4, 8}) {
+        std::atomic<bool> done(false);
+        std::atomic<long> reads(0);
+        long writes = 0;
+        std::vector<std::thread> readers;
+        for(int t = 0; t < threads; t++) {
+            readers.emplace_back([&, t]() {
+                Account found;
+                long mine = 0;
+                for(size_t i = t; !done.load(std::memory_order_relaxed); i = (i + 1) % accts.size(), mine++) {
+                    ctree.retrieveUser(accts[i].getUsername(), accts[i].getDiscriminator(), found);
+                }
+                reads += mine;
+            });
+        }
+        auto start = Clock::now();
+        auto end = start + std::chrono::milliseconds(READ_MILLIS);
+        for(int disc = MIN_DISC; Clock::now() < end; disc = disc % (MAX_DISC - 1) + 1) {
+            ctree.insert(Account("bench_writer", disc, 0, "", ""));
+            writes++;
+        }
+        done = true;
+        for(std::thread& reader : readers) reader.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        cout << "\t" << threads << " readers: " << reads / seconds / 1e6 << " M reads/s, "
+             << writes / seconds << " writes/s" << endl;
+    }
+}
+
+/**
+ * Mixed insert/remove throughput of a ShardedUTree with one writer thread
+ * per shard. Every username keeps a MAX_DISC account so none is emptied.
+**/
+void benchShardedWrites() {
+    std::vector<Account> accts = makeAccounts(NUMSHARDEDOPS);
+    cout << "ShardedUTree mixed writes (" << std::thread::hardware_concurrency() << " cores):" << endl;
+    for(int shards : {1, 2, 4, 8}) {
+        ShardedUTree sharded(shards);
+        for(int i = 0; i < NUMNAMES; i++) sharded.insert(Account("user" + std::to_string(i), MAX_DISC, 0, "", ""));
+
+        auto start = Clock::now();
+        std::vector<std::thread> writers;
+        for(int t = 0; t < shards; t++) {
+            writers.emplace_back([&, t]() {
+                /* Each writer inserts two accounts of its slice, then removes the second */
+                size_t first = accts.size() * t / shards, last = accts.size() * (t + 1) / shards;
+                for(size_t i = first; i < last; i++) {
+                    const Account& acct = (i % 3 == 2 ? accts[i - 1] : accts[i]);
+                    if(acct.getDiscriminator() == MAX_DISC) continue;
+                    if(i % 3 == 2) sharded.removeUser(acct.getUsername(), acct.getDiscriminator());
+                    else sharded.insert(acct);
+                }
+            });
+        }
+        for(std::thread& writer : writers) writer.join();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        cout << "\t" << shards << " shards: " << NUMSHARDEDOPS / seconds / 1e6 << " M ops/s" << endl;
+    }
+}
+
+/**
+ * Lookup cost in a DTree after a remove-heavy workload, with compaction on
+ * remove turned off and on.
+**/
+void benchCompaction() {
+    const int numDiscs = DENSE_ENTER - 1;
+    std::vector<int> discs;
+    for(int disc = 0; disc < numDiscs; disc++) discs.push_back(disc);
+    cout << "DTree lookups after removing 90% of " << numDiscs << " accounts:" << endl;
+    for(int percent : {0, COMPACT_PERCENT}) {
+        DTree dtree;
+        dtree.setCompaction(CompactPolicy(percent, COMPACT_BUDGET));
+        for(int disc : discs) dtree.insert(Account("bench", disc, 0, "", ""));
+        std::shuffle(discs.begin(), discs.end(), rng);
+        DNode* removed;
+        uint64_t reclaimed = Stats::snapshot().vacantReclaimed;
+        for(int i = 0; i < numDiscs * 9 / 10; i++) dtree.remove(discs[i], removed);
+        reclaimed = Stats::snapshot().vacantReclaimed - reclaimed;
+
+        int found = 0;
+        auto start = Clock::now();
+        for(int round = 0; round < 100; round++) {
+            for(int disc = 0; disc < numDiscs; disc++) found += dtree.retrieve(disc) != nullptr;
+        }
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+        cout << "\t" << (percent == 0 ? "no compaction" : "compact at " + std::to_string(percent) + "%")
+             << ": " << reclaimed << " nodes reclaimed, "
+             << ns / (100 * numDiscs) << " ns/lookup" << endl;
+    }
+}
+
+/**
+ * Rebuild work against lookup depth for each balance policy, growing a
+ * DTree just short of dense mode with random and with sequential inserts.
+**/
+void benchBalancePolicies() {
+    struct Policy {const char* name; int policy; int num; int den;};
+    const Policy policies[] = {{"Discord 3/2", BALANCE_DISCORD, 3, 2}, {"Discord 2/1", BALANCE_DISCORD, 2, 1},
+                               {"weight 2/3", BALANCE_WEIGHT, 2, 3}, {"weight 3/4", BALANCE_WEIGHT, 3, 4},
+                               {"scapegoat 2/3", BALANCE_SCAPEGOAT, 2, 3}, {"scapegoat 3/4", BALANCE_SCAPEGOAT, 3, 4}};
+    const int numDiscs = DENSE_ENTER - 1;
+    std::vector<int> random;
+    for(int disc = 0; disc < numDiscs; disc++) random.push_back(disc);
+    std::shuffle(random.begin(), random.end(), rng);
+    std::vector<int> sequential(random);
+    std::sort(sequential.begin(), sequential.end());
+
+    cout << "DTree balance policies, " << numDiscs << " inserts:" << endl;
+    for(const Policy& policy : policies) {
+        for(const std::vector<int>* discs : {&random, &sequential}) {
+            DTree dtree;
+            dtree.setBalance(BalancePolicy(policy.policy, BALANCE_MIN_SIZE, policy.num, policy.den));
+            Stats before = Stats::snapshot();
+            auto start = Clock::now();
+            for(int disc : *discs) dtree.insert(Account("bench", disc, 0, "", ""));
+            auto insertNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            Stats after = Stats::snapshot();
+            long long rebuilds = after.rebuilds - before.rebuilds;
+            long long rebuilt = after.rebuildSizes.sum - before.rebuildSizes.sum;
+
+            int found = 0;
+            start = Clock::now();
+            for(int round = 0; round < 100; round++) {
+                for(int disc : random) found += dtree.retrieve(disc) != nullptr;
+            }
+            auto lookupNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            printf("\t%-14s %-10s %5.1f rebuilds/1000 inserts, %6.1f nodes rebuilt/insert, %5.0f ns/insert, "
+                   "depth %5.2f, %4lld ns/lookup\n", policy.name, discs == &random ? "random" : "sequential",
+                   rebuilds * 1000.0 / numDiscs, double(rebuilt) / numDiscs, double(insertNs) / numDiscs,
+                   dtree.averageDepth(), lookupNs / (100LL * numDiscs));
+        }
+    }
+}
+
+/**
+ * Deletes usernames from a large UTree, each removal taking a username's
+ * only account so its UNode goes too.
+**/
+void benchRemoveUsers() {
+    std::vector<Account> accts;
+    accts.reserve(NUMREMOVENAMES);
+    for(int i = 0; i < NUMREMOVENAMES; i++) accts.push_back(Account("user" + std::to_string(i), i % NUMDISCS, 0, "", ""));
+    std::vector<std::pair<string, int>> victims;
+    for(int i = 0; i < NUMREMOVED; i++) {
+        const Account& acct = accts[std::uniform_int_distribution<>(0, NUMREMOVENAMES - 1)(rng)];
+        victims.emplace_back(acct.getUsername(), acct.getDiscriminator());
+    }
+    UTree utree;
+    std::sort(accts.begin(), accts.end(), [](const Account& a, const Account& b) {return a.getUsername() < b.getUsername();});
+    utree.buildFromSorted(std::move(accts));
+
+    DNode* removed;
+    int numRemoved = 0;
+    auto start = Clock::now();
+    for(const auto& victim : victims) numRemoved += utree.removeUser(victim.first, victim.second, removed);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    cout << "UTree removeUser of " << numRemoved << " usernames from " << NUMREMOVENAMES << ": "
+         << ns / NUMREMOVED << " ns/remove" << endl;
+}
+
+/**
+ * Applies batches of mixed inserts and removes to a loaded UTree, once
+ * through applyBatch and once op by op. Spread batches touch about one
+ * account per username, clustered batches hit 100 usernames hard.
+**/
+void benchApplyBatch() {
+    std::vector<Account> base = makeAccounts(NUMRELOAD);
+    for(bool clustered : {false, true}) {
+        std::vector<std::vector<BatchOp>> batches(NUMBATCHES);
+        for(std::vector<BatchOp>& batch : batches) {
+            std::vector<Account> accts = makeAccounts(BATCH_SIZE);
+            for(int i = 0; i < BATCH_SIZE; i++) {
+                Account acct = (i % 3 == 0 ? base[rng() % base.size()] : accts[i]);
+                if(clustered) {
+                    acct = Account("user" + std::to_string(rng() % 100), acct.getDiscriminator(), 0, "", "");
+                }
+                /* a third of the ops remove an account */
+                batch.push_back(BatchOp{i % 3 == 0 ? BATCH_REMOVE : BATCH_INSERT, acct});
+            }
+        }
+
+        cout << "UTree " << (clustered ? "clustered" : "spread") << " batches of " << BATCH_SIZE << " ops:" << endl;
+        for(bool batched : {false, true}) {
+            UTree utree;
+            for(const Account& acct : base) utree.insert(acct);
+            DNode* removed;
+            auto start = Clock::now();
+            for(const std::vector<BatchOp>& batch : batches) {
+                if(batched) {
+                    utree.applyBatch(batch);
+                } else {
+                    for(const BatchOp& op : batch) {
+                        if(op.type == BATCH_INSERT) utree.insert(op.account);
+                        else utree.removeUser(op.account.getUsername(), op.account.getDiscriminator(), removed);
+                    }
+                }
+            }
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            cout << "\t" << (batched ? "applyBatch" : "one at a time") << ": " << ns / (NUMBATCHES * BATCH_SIZE) << " ns/op" << endl;
+        }
+    }
+}
+
+/**
+ * retrieveUser and numUsers on a UTree and on its frozen copy, looking up
+ * stored accounts in random order.
+**/
+void benchFrozen() {
+    std::uniform_int_distribution<> distName(0, NUMFROZENNAMES - 1);
+    std::uniform_int_distribution<> distDisc(MIN_DISC, MAX_DISC);
+    std::vector<Account> accts;
+    accts.reserve(NUMFROZEN);
+    for(int i = 0; i < NUMFROZEN; i++) {
+        accts.push_back(Account("user" + std::to_string(distName(rng)), distDisc(rng), 0, "", ""));
+    }
+    UTree utree;
+    for(const Account& acct : accts) utree.insert(acct);
+    FrozenUTree frozen = utree.freeze();
+    std::shuffle(accts.begin(), accts.end(), rng);
+
+    cout << "Lookups over " << NUMFROZEN << " accounts:" << endl;
+    long found = 0;
+    auto start = Clock::now();
+    for(const Account& acct : accts) found += utree.retrieveUser(acct.getUsername(), acct.getDiscriminator()) != nullptr;
+    auto mid = Clock::now();
+    for(const Account& acct : accts) found += frozen.retrieveUser(acct.getUsername(), acct.getDiscriminator()) != nullptr;
+    auto end = Clock::now();
+    cout << "\tretrieveUser: UTree " << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / NUMFROZEN
+         << " ns, frozen " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / NUMFROZEN << " ns" << endl;
+
+    start = Clock::now();
+    for(const Account& acct : accts) found += utree.numUsers(acct.getUsername());
+    mid = Clock::now();
+    for(const Account& acct : accts) found += frozen.numUsers(acct.getUsername());
+    end = Clock::now();
+    cout << "\tnumUsers: UTree " << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / NUMFROZEN
+         << " ns, frozen " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / NUMFROZEN
+         << " ns (" << found << ")" << endl;
+}
+
+/**
+ * retrieve on DTrees of 1 to SMALL_CUTOFF users, as sorted arrays (a DTree
+ * sharing a pool, as in a UTree) against nodes (a DTree on its own).
+**/
+void benchSmallLookups() {
+    NodePool<DNode> pool;
+    std::vector<DTree*> small, nodes;
+    std::vector<std::vector<int>> discs(NUMSMALLTREES);
+    std::uniform_int_distribution<> distDisc(MIN_DISC, MAX_DISC);
+    for(int t = 0; t < NUMSMALLTREES; t++) {
+        small.push_back(new DTree(&pool));
+        nodes.push_back(new DTree());
+        int count = 1 + t % SMALL_CUTOFF;
+        while(int(discs[t].size()) < count) {
+            Account acct("user" + std::to_string(t), distDisc(rng), 0, "", "");
+            if(small[t]->insert(acct)) {
+                nodes[t]->insert(acct);
+                discs[t].push_back(acct.getDiscriminator());
+            }
+        }
+    }
+    std::vector<std::pair<int, int>> lookups;
+    for(int i = 0; i < NUMSMALLLOOKUPS; i++) {
+        int t = rng() % NUMSMALLTREES;
+        lookups.push_back({t, i % 2 == 0 ? discs[t][rng() % discs[t].size()] : distDisc(rng)});
+    }
+
+    long found = 0;
+    auto start = Clock::now();
+    for(auto& [t, disc] : lookups) found += nodes[t]->retrieve(disc) != nullptr;
+    auto mid = Clock::now();
+    for(auto& [t, disc] : lookups) found += small[t]->retrieve(disc) != nullptr;
+    auto end = Clock::now();
+    cout << "Lookups in DTrees of 1 to " << SMALL_CUTOFF << " users (" << DTree::smallSearch() << "):" << endl;
+    cout << "\tnodes " << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / NUMSMALLLOOKUPS
+         << " ns, small " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / NUMSMALLLOOKUPS
+         << " ns (" << found << ")" << endl;
+    for(int t = 0; t < NUMSMALLTREES; t++) {
+        delete small[t];
+        delete nodes[t];
+    }
+}
+
+/**
+ * Autocomplete queries of PREFIX_LIMIT usernames, on the tree and on the
+ * front coded index, with prefixes of 1 to 6 characters of stored usernames.
+**/
+void benchPrefixScan() {
+    std::vector<Account> accts;
+    accts.reserve(NUMPREFIXNAMES);
+    for(int i = 0; i < NUMPREFIXNAMES; i++) {
+        accts.push_back(Account("user" + std::to_string(rng() % 100000000), 1, 0, "", ""));
+    }
+    UTree utree;
+    for(const Account& acct : accts) utree.insert(acct);
+    auto built = Clock::now();
+    PrefixIndex index(utree);
+    auto indexed = Clock::now();
+    std::vector<string> prefixes;
+    for(int i = 0; i < NUMPREFIXQUERIES; i++) {
+        prefixes.push_back(accts[rng() % NUMPREFIXNAMES].getUsername().substr(0, 5 + rng() % 6));
+    }
+
+    long found = 0;
+    auto start = Clock::now();
+    for(const string& prefix : prefixes) found += utree.prefixScan(prefix, PREFIX_LIMIT).size();
+    auto mid = Clock::now();
+    for(const string& prefix : prefixes) found += index.complete(prefix, PREFIX_LIMIT).size();
+    auto end = Clock::now();
+    cout << "Prefix queries over " << index.numUsernames() << " usernames, limit " << PREFIX_LIMIT << ":" << endl;
+    cout << "\tprefixScan " << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / NUMPREFIXQUERIES
+         << " ns, index " << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / NUMPREFIXQUERIES
+         << " ns (" << found << ")" << endl;
+    cout << "\tindex: " << index.bytes() / (1024 * 1024) << " MB, built in "
+         << std::chrono::duration_cast<std::chrono::milliseconds>(indexed - built).count() << " ms" << endl;
+}
+
+/**
+ * Walks every account with the iterators, and a range of a tenth of the
+ * usernames.
+**/
+void benchIteration() {
+    UTree utree;
+    for(int i = 0; i < NUMSCANNED; i++) {
+        utree.insert(Account("user" + std::to_string(rng() % (NUMSCANNED / 4)), rng() % NUMDISCS, 0, "", ""));
+    }
+    long sum = 0, count = 0;
+    auto start = Clock::now();
+    for(const Account& acct : utree) {
+        sum += acct.getDiscriminator();
+        count++;
+    }
+    auto mid = Clock::now();
+    long ranged = 0;
+    for(const Account& acct : utree.range("user1", "user2")) {
+        sum += acct.getDiscriminator();
+        ranged++;
+    }
+    auto end = Clock::now();
+    cout << "Iterating " << count << " accounts: "
+         << std::chrono::duration_cast<std::chrono::nanoseconds>(mid - start).count() / count << " ns/account" << endl;
+    cout << "\trange of " << ranged << " accounts: "
+         << std::chrono::duration_cast<std::chrono::nanoseconds>(end - mid).count() / std::max(ranged, 1L)
+         << " ns/account (" << sum << ")" << endl;
+}
+
+/**
+ * Exports the tree in each format to a file, against writing each account
+ * through an ofstream with endl as printUsers used to.
+**/
+void benchExport() {
+    UTree utree;
+    for(int i = 0; i < NUMEXPORTED; i++) {
+        utree.insert(Account("user" + std::to_string(rng() % (NUMEXPORTED / 4)), rng() % NUMDISCS, i % 2, "Subscriber", "status"));
+    }
+    cout << "Exporting " << NUMEXPORTED << " accounts:" << endl;
+    auto start = Clock::now();
+    {
+        std::ofstream out(BENCH_EXPORT);
+        for(const Account& acct : utree) out << acct << endl;
+    }
+    cout << "\tofstream with endl: " << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count() << " ms" << endl;
+    const char* names[] = {"csv", "json", "snapshot"};
+    for(int format : {EXPORT_CSV, EXPORT_JSON, EXPORT_SNAPSHOT}) {
+        start = Clock::now();
+        {
+            FileSink sink(BENCH_EXPORT);
+            utree.exportTo(sink, format);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::ifstream written(BENCH_EXPORT, std::ios::ate | std::ios::binary);
+        cout << "\texportTo " << names[format] << ": " << int(seconds * 1000) << " ms, "
+             << int(written.tellg() / seconds / (1024 * 1024)) << " MB/s" << endl;
+    }
+    std::remove(BENCH_EXPORT);
+}
+
+int main() {
+    benchDTreeInsert();
+    benchUTreeReload();
+    benchUTreeRetrieve();
+    benchLoaders();
+    benchSnapshot();
+    benchJournal();
+    benchConcurrentReads();
+    benchShardedWrites();
+    benchCompaction();
+    benchBalancePolicies();
+    benchRemoveUsers();
+    benchApplyBatch();
+    benchFrozen();
+    benchSmallLookups();
+    benchPrefixScan();
+    benchIteration();
+    benchExport();
+    return 0;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+/* Bytes apart that data written by different threads has to be to keep off
+ * each other's cache lines. A fixed 64 rather than
+ * std::hardware_destructive_interference_size, whose value can change with
+ * compiler flags and so isn't safe to use in a header */
+#define CACHE_LINE 64
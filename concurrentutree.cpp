@@ -0,0 +1,112 @@
+#include "concurrentutree.h"
+#include <functional>
+#include <thread>
+#include <vector>
+
+ConcurrentUTree::ConcurrentUTree(): _published(0), _version(0) {}
+
+bool ConcurrentUTree::ReadIndicator::isEmpty() const {
+    for(int i = 0; i < READ_STRIPES; i++) {
+        if(stripes[i].readers.load() != 0) return false;
+    }
+    return true;
+}
+
+/**
+ * Enters the current version before looking up the published copy, so a
+ * writer that waits for the version to drain also waits for this reader.
+ */
+ConcurrentUTree::ReadGuard::ReadGuard(const ConcurrentUTree& tree):
+    _owner(tree), _version(tree._version.load()), _stripe(stripe()) {
+    tree._indicators[_version].arrive(_stripe);
+    _tree = &tree._trees[tree._published.load()];
+}
+
+ConcurrentUTree::ReadGuard::~ReadGuard() {
+    _owner._indicators[_version].depart(_stripe);
+}
+
+/**
+ * Makes tree the copy readers search and waits until no reader can still
+ * be inside the other one.
+ * @param tree index of the copy that was just written
+ */
+void ConcurrentUTree::publish(int tree) {
+    _published.store(tree);
+
+    /* A reader that entered either version may have read the old index.
+     * Drain the idle version, move new readers onto it, then drain the
+     * version they were arriving on */
+    int current = _version.load();
+    int next = 1 - current;
+    while(!_indicators[next].isEmpty()) std::this_thread::yield();
+    _version.store(next);
+    while(!_indicators[current].isEmpty()) std::this_thread::yield();
+}
+
+/**
+ * Rebuilds a hidden copy from the published one after a write failed
+ * partway through it. Readers may still search the published copy, which is
+ * only read.
+ * @param tree index of the hidden copy
+ */
+void ConcurrentUTree::resync(int tree) {
+    const UTree& published = _trees[1 - tree];
+    _trees[tree].buildFromSorted(std::vector<Account>(published.begin(), published.end()));
+}
+
+/**
+ * Stripe of the calling thread, fixed for the life of the thread.
+ */
+int ConcurrentUTree::stripe() {
+    thread_local int mine = std::hash<std::thread::id>()(std::this_thread::get_id()) % READ_STRIPES;
+    return mine;
+}
+
+bool ConcurrentUTree::hasUser(std::string_view username) const {
+    return read([&](const UTree& utree) {return utree.retrieve(username) != nullptr;});
+}
+
+/**
+ * Copies the account with the given username and discriminator into found.
+ * @return true if the account exists and is not vacant
+ */
+bool ConcurrentUTree::retrieveUser(std::string_view username, int disc, Account& found) const {
+    return read([&](const UTree& utree) {
+        DNode* node = utree.retrieveUser(username, disc);
+        if(node == nullptr || node->isVacant()) return false;
+        found = node->getAccount();
+        return true;
+    });
+}
+
+int ConcurrentUTree::numUsers(std::string_view username) const {
+    return read([&](const UTree& utree) {return utree.numUsers(username);});
+}
+
+bool ConcurrentUTree::insert(Account newAcct) {
+    return write([&](UTree& utree) {return utree.insert(newAcct);});
+}
+
+bool ConcurrentUTree::removeUser(std::string_view username, int disc) {
+    return write([&](UTree& utree) {
+        DNode* removed;
+        return utree.removeUser(username, disc, removed);
+    });
+}
+
+void ConcurrentUTree::loadMapped(string infile, bool append) {
+    write([&](UTree& utree) {utree.loadMapped(infile, append);});
+}
+
+void ConcurrentUTree::clear() {
+    write([](UTree& utree) {utree.clear();});
+}
+
+void ConcurrentUTree::setBalance(const BalancePolicy& balance) {
+    write([&](UTree& utree) {utree.setBalance(balance);});
+}
+
+void ConcurrentUTree::setCompaction(const CompactPolicy& compaction) {
+    write([&](UTree& utree) {utree.setCompaction(compaction);});
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "utree.h"
+#include "cacheline.h"
+#include <atomic>
+#include <mutex>
+#include <string_view>
+
+#define READ_STRIPES 16         /* reader counters per indicator */
+
+/**
+ * UTree that many threads can read while one thread at a time writes.
+ *
+ * Two full copies of the tree are kept (the Left-Right technique). Readers
+ * always search the copy that is currently published and never wait on a
+ * lock. A writer applies its change to the hidden copy, publishes that copy,
+ * waits for readers still inside the old one to leave, then repeats the
+ * change on the old copy. Rotations and DTree rebuilds therefore only happen
+ * on a copy that no reader can see, and switching copies is a single atomic
+ * store.
+ *
+ * Readers get copies of what they find. A DNode* would point into a tree the
+ * next writer is allowed to change.
+ */
+class ConcurrentUTree {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    ConcurrentUTree();
+
+    ConcurrentUTree(const ConcurrentUTree&) = delete;
+    ConcurrentUTree& operator=(const ConcurrentUTree&) = delete;
+
+    /* Reads, safe from any number of threads */
+    bool hasUser(std::string_view username) const;
+    bool retrieveUser(std::string_view username, int disc, Account& found) const;
+    int numUsers(std::string_view username) const;
+    template <class Read>
+    auto read(Read read) const;
+
+    /* Writes, serialized against each other */
+    bool insert(Account newAcct);
+    bool removeUser(std::string_view username, int disc);
+    void loadMapped(string infile, bool append = true);
+    void clear();
+    void setBalance(const BalancePolicy& balance);
+    void setCompaction(const CompactPolicy& compaction);
+    template <class Write>
+    auto write(Write write);
+
+private:
+    /* Counts readers inside one version, spread over several cache lines
+     * so readers on different cores don't fight over one counter */
+    struct ReadIndicator {
+        struct alignas(CACHE_LINE) Stripe {
+            std::atomic<int> readers{0};
+        };
+        Stripe stripes[READ_STRIPES];
+
+        void arrive(int stripe) {stripes[stripe].readers.fetch_add(1);}
+        void depart(int stripe) {stripes[stripe].readers.fetch_sub(1);}
+        bool isEmpty() const;
+    };
+
+    /* Leaves the version it entered when it goes out of scope */
+    class ReadGuard {
+    public:
+        ReadGuard(const ConcurrentUTree& tree);
+        ~ReadGuard();
+        const UTree& tree() const {return *_tree;}
+    private:
+        const ConcurrentUTree& _owner;
+        int _version;
+        int _stripe;
+        const UTree* _tree;
+    };
+
+    UTree _trees[2];
+    std::atomic<int> _published;        /* copy readers search */
+    std::atomic<int> _version;          /* indicator new readers arrive on */
+    mutable ReadIndicator _indicators[2];
+    std::mutex _writer;
+
+    void publish(int tree);
+    void resync(int tree);
+    static int stripe();
+};
+
+/**
+ * Runs read on the published copy and returns its result. read gets a
+ * const UTree& that must not escape the call.
+ */
+template <class Read>
+auto ConcurrentUTree::read(Read read) const {
+    ReadGuard guard(*this);
+    return read(guard.tree());
+}
+
+/**
+ * Runs write on both copies, one after the other, and returns what the
+ * second call returned. write must make the same change both times. If it
+ * throws, the copy it was changing is rebuilt from the other one before the
+ * exception is passed on, so the copies never drift apart.
+ */
+template <class Write>
+auto ConcurrentUTree::write(Write write) {
+    std::lock_guard<std::mutex> lock(_writer);
+    int hidden = 1 - _published.load();
+    try {
+        write(_trees[hidden]);
+    } catch(...) {
+        resync(hidden);
+        throw;
+    }
+    publish(hidden);
+    try {
+        return write(_trees[1 - hidden]);
+    } catch(...) {
+        resync(1 - hidden);
+        throw;
+    }
+}
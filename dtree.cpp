@@ -1,10 +1,49 @@
 #include "dtree.h"
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DTREE_X86
+#endif
+
+#ifdef UTREE_STATS
+/**
+ * Bytes an account's strings hold outside the account itself.
+**/
+static size_t heapBytes(const Account& acct){
+  size_t bytes = 0;
+  for(const string* str : {&acct.getUsername(), &acct.getBadge(), &acct.getStatus()}){
+    const char* data = str->data();
+    bool inPlace = data >= reinterpret_cast<const char*>(str) && data < reinterpret_cast<const char*>(str + 1);
+    if(!inPlace){bytes += str->capacity() + 1;}
+  }
+  return bytes;
+}
+#endif
+
+/**
+ * The fastest small tree search the CPU supports, picked on first use so a
+ * DTree built while globals are still being set up can search too.
+**/
+DTree::SmallFind DTree::smallFind(){
+  static const SmallFind find = []() -> SmallFind {
+#ifdef DTREE_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? findAVX2 : findSSE2;
+#else
+    return findScalar;
+#endif
+  }();
+  return find;
+}
 
 /**
  * Destructor, deletes all dynamic memory.
 **/
 DTree::~DTree() {
   clear();
+  if(_ownsPool){
+    delete _pool;
+  }
 }
 
 /**
@@ -15,9 +54,26 @@ DTree::~DTree() {
 DTree& DTree::operator=(const DTree& rhs) {
   if(this != &rhs){
     clear();
-    DNode* newRoot = new DNode(rhs._root->_account);
-    _root = newRoot;
-    makeDeep(rhs._root, _root);
+    _balance = rhs._balance;
+    _compaction = rhs._compaction;
+    if(rhs._dense != nullptr){
+      _dense = new DenseDiscs(*rhs._dense);
+      for(int page = 0; page < DENSE_PAGES; page++){
+        if(rhs._dense->pages[page] != nullptr){
+          _dense->pages[page] = new DNode[DENSE_PAGE_SIZE];
+          std::copy(rhs._dense->pages[page], rhs._dense->pages[page] + DENSE_PAGE_SIZE, _dense->pages[page]);
+        }
+      }
+    }else if(rhs._small != nullptr){
+      _small = new SmallDiscs{rhs._small->username, rhs._small->count, rhs._small->discs, {}, nullptr};
+      for(DNode* node : rhs._small->nodes){
+        _small->nodes.push_back(_pool->create(node->_account));
+      }
+    }else if(rhs._root != nullptr){
+      DNode* newRoot = _pool->create(rhs._root->_account);
+      _root = newRoot;
+      makeDeep(rhs._root, _root);
+    }
   }
   return *this;
 }
@@ -32,7 +88,7 @@ void DTree::makeDeep(const DNode* rhs, DNode*& node){
       makeDeep(rhs->_left, node->_left);
       makeDeep(rhs->_right, node->_right);
     }else{
-      DNode* newNode = new DNode(rhs->_account);
+      DNode* newNode = _pool->create(rhs->_account);
       node = newNode;
       makeDeep(rhs->_left, node->_left);
       makeDeep(rhs->_right, node->_right);
@@ -54,77 +110,161 @@ void DTree::printRoot(DTree& node){
  * @return true if the account was inserted, false otherwise
 **/
 bool DTree::insert(Account newAcct) {
+  if(_dense != nullptr){
+    return insertDense(newAcct);
+  }
+  if(_smallMode && _root == nullptr && _small == nullptr){
+    _small = new SmallDiscs{newAcct._username, 0, {}, {}, nullptr};
+  }
+  if(_small != nullptr){
+    if(_small->count < SMALL_CUTOFF || retrieve(newAcct._disc) != nullptr){
+      return insertSmall(newAcct);
+    }
+    //one past the cutoff, go to nodes and insert there
+    makeSparse();
+  }
   //ONLY insert newAcct if it doesn't already exist in Dtree. 
   if(retrieve(newAcct._disc) != nullptr){
     return false;
   }
-  bool success = insert(newAcct, _root);
-  helpUpdateSize(_root);
-  helpCheckBalance(_root);
+  //sizes are fixed up on the way back out of the recursion, so only the
+  //insertion path is touched. The highest imbalanced node is rebuilt after.
+  int disc = newAcct._disc;
+  DNode** imbalanced = nullptr;
+  bool success = insert(newAcct, _root, imbalanced);
+  if(imbalanced != nullptr
+     && (_balance.rule() != BALANCE_SCAPEGOAT || tooDeep(disc))){
+    int reclaimed = (*imbalanced)->_numVacant;
+    rebalance(*imbalanced);
+    if(reclaimed > 0){
+      updatePath(disc, *imbalanced, reclaimed);
+    }
+  }
+  if(success && getNumUsers() >= DENSE_ENTER){
+    makeDense();
+  }
   return success;
 }
 
 
-bool DTree::insert(Account newAcct, DNode*& node){
+bool DTree::insert(Account& newAcct, DNode*& node, DNode**& imbalanced){
   if(node == nullptr){
-    DNode* newNode = new DNode(newAcct);
+    DNode* newNode = _pool->create(std::move(newAcct));
     node = newNode;
     return true;
+  }
+  if(node->isVacant() && fitsVacant(newAcct._disc, node)){
+    //reuse the vacant node in place so its subtrees are kept
+    node->_account = std::move(newAcct);
+    node->_vacant = false;
+    updateNumVacant(node);
+    return true;
+  }
+  bool success;
+  if(newAcct._disc < node->_account._disc){
+    success = insert(newAcct, node->_left, imbalanced);
   }else{
-    if(newAcct._disc < node->_account._disc){
-      if(node->isVacant()){
-	DNode* newNode = new DNode(newAcct);
-	node = newNode;
-	node->_vacant = false;
-	updateNumVacant(node);
-	return true;
-      }else{
-	return insert(newAcct, node->_left);
-      }
-    }else{
-      if(node->isVacant()){
-	DNode* newNode = new DNode(newAcct);
-	node = newNode;
-	node->_vacant = false;
-	updateNumVacant(node);
-	return true;
-      }else{
-	return insert(newAcct, node->_right);
-      }
+    success = insert(newAcct, node->_right, imbalanced);
+  }
+  updateSize(node);
+  updateNumVacant(node);
+  if(_balance.rule() == BALANCE_SCAPEGOAT){
+    if(imbalanced == nullptr && checkImbalance(node)){
+      imbalanced = &node; //the lowest one, a scapegoat rebuild stays small
     }
+  }else if(checkImbalance(node)){
+    imbalanced = &node; //ancestors overwrite this, leaving the highest one
   }
-  return false;
+  return success;
 }
 
 /**
- *Helper function to updateSize of node.
- * this function will take in the root node of the tree, do an inorder
- * traversal through the tree and update it's size at each node.
+ * Replaces the contents of the tree with a perfectly balanced tree built in
+ * O(n) from accounts sorted by discriminator. Repeated discriminators keep
+ * the first account, as repeated inserts would.
+ * @param sorted Accounts in ascending discriminator order
 **/
-void DTree::helpUpdateSize(DNode* node){
-  if(node == nullptr){return;}
-  helpUpdateSize(node->_left);
-  helpUpdateSize(node->_right);
-  updateSize(node);
-  updateNumVacant(node);
+void DTree::buildFromSorted(std::vector<Account> sorted) {
+  for(size_t i = 1; i < sorted.size(); i++){
+    if(sorted[i]._disc < sorted[i-1]._disc){
+      throw std::invalid_argument("buildFromSorted: accounts are not sorted by discriminator");
+    }
+  }
+  buildFromSorted(sorted.data(), sorted.size());
+}
+
+void DTree::buildFromSorted(Account* first, int count){
+  clear();
+  if(_smallMode && count > 0 && count <= SMALL_CUTOFF){
+    buildSmall(first, count);
+    return;
+  }
+  buildNodes(first, count);
+  if(getNumUsers() >= DENSE_ENTER){
+    makeDense();
+  }
 }
 
 /**
- *Helper function to checkImbalance of node.
- * this function will take in the root node of the tree, do an inorder
- * traversal through the tree and check if it's imbalanced at each node.
+ * Helper function for buildFromSorted, links the accounts into a balanced
+ * node tree. The tree must be empty.
 **/
-void DTree::helpCheckBalance(DNode*& node){
-  if(node == nullptr){return;}
-  helpCheckBalance(node->_left);
-  helpCheckBalance(node->_right);
-  if(checkImbalance(node)){
-    rebalance(node);
-    //helpCheckBalance(_root);
+void DTree::buildNodes(Account* first, int count){
+  DNode** tempArr = new DNode *[count];
+  int size = 0;
+  for(int i = 0; i < count; i++){
+    if(size > 0 && tempArr[size-1]->_account._disc == first[i]._disc){
+      continue;
+    }
+    tempArr[size++] = _pool->create(std::move(first[i]));
   }
+  _root = fillTree(tempArr, 0, size - 1);
+  delete [] tempArr;
 }
 
+/**
+ * Helper function for insert.
+ * A vacant node can only take the new account if its discriminator still
+ * sits between the vacant node's left and right subtrees.
+**/
+bool DTree::fitsVacant(int disc, DNode* node){
+  if(disc < node->_account._disc){
+    DNode* maxLeft = node->_left;
+    while(maxLeft != nullptr && maxLeft->_right != nullptr){
+      maxLeft = maxLeft->_right;
+    }
+    return maxLeft == nullptr || maxLeft->_account._disc < disc;
+  }else if(disc > node->_account._disc){
+    DNode* minRight = findMin(node->_right);
+    return minRight == nullptr || minRight->_account._disc > disc;
+  }
+  return true;
+}
 
+/**
+ * Helper function for insert.
+ * After a rebuild drops vacant nodes, walks from the root down to the rebuilt
+ * subtree and takes the reclaimed nodes off each ancestor's counts.
+**/
+void DTree::updatePath(int disc, DNode* stop, int reclaimed){
+  DNode* node = _root;
+  while(node != stop){
+    node->_size -= reclaimed;
+    node->_numVacant -= reclaimed;
+    if(disc < node->_account._disc){
+      node = node->_left;
+    }else{
+      node = node->_right;
+    }
+  }
+}
+
+DNode* DTree::findMin(DNode* node){
+  while(node != nullptr && node->_left != nullptr){
+    node = node->_left;
+  }
+  return node;
+}
 
 /**
  * Removes the specified DNode from the tree.
@@ -134,6 +274,29 @@ void DTree::helpCheckBalance(DNode*& node){
 **/
 
 bool DTree::remove(int disc, DNode*& removed) {
+  //nodes emptied by earlier removes are dropped first, the node this remove
+  //empties stays valid for the caller until the next one
+  compactPath(disc);
+  if(_dense != nullptr){
+    DNode* slot = denseSlot(disc);
+    if(slot == nullptr){return false;}
+    if(_dense->count > DENSE_LEAVE){
+      int index = disc - MIN_DISC;
+      _dense->bits[index / DENSE_PAGE_SIZE] &= ~(uint64_t(1) << (index % DENSE_PAGE_SIZE));
+      _dense->count--;
+      slot->_vacant = true;
+      removed = slot;
+      return true;
+    }
+    //too sparse to stay dense, go back to nodes and remove from those
+    makeSparse();
+  }
+  if(_smallMode && _root != nullptr && getNumUsers() <= SMALL_LEAVE){
+    makeSmall();
+  }
+  if(_small != nullptr){
+    return removeSmall(disc, removed);
+  }
   DNode* nodeRemoved = retrieve(disc);
   if(nodeRemoved != nullptr){
     removed = nodeRemoved;
@@ -165,18 +328,30 @@ void DTree::updateParents(int disc, DNode*& parent){
 }
 
 /**
- * Retrieves the specified Account within a DNode.
+ * Retrieves the specified Account within a DNode. The node keeps its address
+ * while the user stays in the tree, through rebuilds and small mode, but not
+ * when the tree goes into or out of dense mode, which moves every account.
  * @param disc discriminator int to search for
  * @return DNode with a matching discriminator, nullptr otherwise
 **/
-DNode* DTree::retrieve(int disc) {
+DNode* DTree::retrieve(int disc) const {
+  STATS_COUNT(dtreeLookups);
+  if(_dense != nullptr){
+    return denseSlot(disc);
+  }
+  if(_small != nullptr){
+    STATS_COUNT(dtreeComparisons);
+    int index = smallFind()(_small->discs.data(), _small->count, disc);
+    return index < 0 ? nullptr : _small->nodes[index];
+  }
   DNode* matchFound = retrieve(disc, _root);
   return matchFound;
 }
 
 
-DNode* DTree::retrieve(int disc, DNode* node) {
+DNode* DTree::retrieve(int disc, DNode* node) const {
   if(node != nullptr){
+    STATS_COUNT(dtreeComparisons);
     if(node->_account._disc == disc){
       if(!node->isVacant()){
 	return node; //if node isn't vacant and a match, return curr node
@@ -194,10 +369,25 @@ DNode* DTree::retrieve(int disc, DNode* node) {
 
 /**
  * Helper for the destructor to clear dynamic memory.
+ * A tree that owns its pool gives back whole blocks at once, a tree sharing
+ * its pool returns each node to the free list.
 **/
 void DTree::clear() {
+  clearDense();
+  if(_small != nullptr){
+    dropRemoved();
+    for(DNode* node : _small->nodes){
+      _pool->destroy(node);
+    }
+    delete _small;
+    _small = nullptr;
+  }
   if (_root != nullptr){
-    clearTree(_root);
+    if(_ownsPool){
+      _pool->release();
+    }else{
+      clearTree(_root);
+    }
     _root = nullptr;
   }
 }
@@ -208,7 +398,7 @@ void DTree::clearTree(DNode* node){
   else{
     clearTree(node->_left);
     clearTree(node->_right);
-    delete node;
+    _pool->destroy(node);
     }
 }
 
@@ -216,23 +406,101 @@ void DTree::clearTree(DNode* node){
  * Prints all accounts' details within the DTree.
 **/
 void DTree::printAccounts() const {
-  printAccounts(_root);
+  for(const Account& acct : *this){
+    cout << '\n' << acct;
+  }
 }
 
-void DTree::printAccounts(DNode* node) const {
-  if(node == nullptr){
-    return;
+/**
+ * Iterator at the valid user with the smallest discriminator.
+**/
+DTree::const_iterator DTree::begin() const {
+  const_iterator it;
+  it._tree = this;
+  if(_dense != nullptr){
+    it.nextDense(0);
+  }else if(_small != nullptr){
+    it._node = (_small->count > 0 ? _small->nodes[0] : nullptr);
+  }else{
+    it.pushLeft(_root);
+    it.nextNode();
+  }
+  return it;
+}
+
+DTree::const_iterator& DTree::const_iterator::operator++() {
+  if(_tree->_dense != nullptr){
+    nextDense(_index + 1);
+  }else if(_tree->_small != nullptr){
+    _index++;
+    _node = (_index < _tree->_small->count ? _tree->_small->nodes[_index] : nullptr);
+  }else{
+    nextNode();
   }
-  printAccounts(node->_left);
-  if(!node->isVacant()){
-    cout << endl << node->_account;
+  return *this;
+}
+
+/**
+ * Pushes node and its chain of left children, stopping at the first
+ * subtree without a valid user.
+**/
+void DTree::const_iterator::pushLeft(DNode* node) {
+  for(; node != nullptr && numLive(node) > 0; node = node->_left){
+    _stack.push_back(node);
+  }
+}
+
+/**
+ * Moves to the next valid node in order, its left subtree is done once it
+ * is on top of the stack.
+**/
+void DTree::const_iterator::nextNode() {
+  _node = nullptr;
+  while(_node == nullptr && !_stack.empty()){
+    DNode* node = _stack.back();
+    _stack.pop_back();
+    pushLeft(node->_right);
+    if(!node->_vacant){
+      _node = node;
+    }
+  }
+}
+
+/**
+ * Moves to the first used slot of a dense tree at or after index.
+**/
+void DTree::const_iterator::nextDense(int index) {
+  _node = nullptr;
+  for(int page = index / DENSE_PAGE_SIZE; page < DENSE_PAGES; page++){
+    uint64_t bits = _tree->_dense->bits[page];
+    if(page == index / DENSE_PAGE_SIZE){
+      bits &= ~uint64_t(0) << (index % DENSE_PAGE_SIZE);
+    }
+    if(bits != 0){
+      int slot = __builtin_ctzll(bits);
+      _index = page * DENSE_PAGE_SIZE + slot;
+      _node = &_tree->_dense->pages[page][slot];
+      return;
+    }
   }
-  printAccounts(node->_right);
 }
 
 /**
- * Dump the DTree in the '()' notation.
+ * Dump the DTree in the '()' notation. Dense and small trees have no shape
+ * to show and print as [dense:number of users] or [small:number of users].
 **/
+void DTree::dump() const {
+  if(_dense != nullptr){
+    cout << "[dense:" << _dense->count << "]";
+    return;
+  }
+  if(_small != nullptr){
+    cout << "[small:" << _small->count << "]";
+    return;
+  }
+  dump(_root);
+}
+
 void DTree::dump(DNode* node) const {
   if(node == nullptr) return;
     cout << "(";
@@ -247,7 +515,213 @@ void DTree::dump(DNode* node) const {
  * @return number of non-vacant nodes
 **/
 int DTree::getNumUsers() const {
-  return _root->_size - _root->_numVacant;
+  if(_dense != nullptr){
+    return _dense->count;
+  }
+  if(_small != nullptr){
+    return _small->count;
+  }
+  return numLive(_root);
+}
+
+/**
+ * Walks the node tree adding up the depth of every valid user.
+ * @return mean comparisons a retrieve of a valid user makes, 0 if there are none
+**/
+double DTree::averageDepth() const {
+  if(_dense != nullptr || getNumUsers() == 0){
+    return 0;
+  }
+  if(_small != nullptr){
+    return 1;
+  }
+  long long total = 0;
+  std::vector<std::pair<DNode*, int>> stack = {{_root, 1}};
+  while(!stack.empty()){
+    auto [node, depth] = stack.back();
+    stack.pop_back();
+    if(!node->_vacant){total += depth;}
+    if(node->_left != nullptr){stack.push_back({node->_left, depth + 1});}
+    if(node->_right != nullptr){stack.push_back({node->_right, depth + 1});}
+  }
+  return double(total) / getNumUsers();
+}
+
+/**
+ * Username shared by every account in the tree.
+**/
+const string& DTree::getUsername() const {
+  if(_dense != nullptr){
+    return _dense->username;
+  }
+  if(_small != nullptr){
+    return _small->username;
+  }
+  return _root->getUsername();
+}
+
+/**
+ * Counts the valid users with a smaller discriminator than disc, using the
+ * subtree counters on the search path instead of visiting every node.
+ * @param disc discriminator to rank, it doesn't have to be in the tree
+ * @return number of non-vacant nodes with a discriminator below disc
+**/
+int DTree::rank(int disc) const {
+  if(_dense != nullptr){
+    //whole bitmap words below disc, then the part of disc's own word
+    int index = std::min(std::max(disc - MIN_DISC, 0), MAX_DISC - MIN_DISC + 1);
+    int below = 0;
+    for(int page = 0; page < index / DENSE_PAGE_SIZE; page++){
+      below += __builtin_popcountll(_dense->bits[page]);
+    }
+    if(index % DENSE_PAGE_SIZE != 0){
+      uint64_t mask = (uint64_t(1) << (index % DENSE_PAGE_SIZE)) - 1;
+      below += __builtin_popcountll(_dense->bits[index / DENSE_PAGE_SIZE] & mask);
+    }
+    return below;
+  }
+  if(_small != nullptr){
+    const int16_t* discs = _small->discs.data();
+    return std::lower_bound(discs, discs + _small->count, disc) - discs;
+  }
+  int below = 0;
+  DNode* node = _root;
+  while(node != nullptr){
+    if(disc <= node->_account._disc){
+      node = node->_left;
+    }else{
+      below += numLive(node->_left) + (node->_vacant ? 0 : 1);
+      node = node->_right;
+    }
+  }
+  return below;
+}
+
+/**
+ * Finds the valid user at position k in discriminator order, skipping
+ * vacant nodes, so a caller can page through the tree k at a time. The
+ * node stays valid as long as one from retrieve would.
+ * @param k zero based position among the non-vacant nodes
+ * @return the k-th non-vacant node, nullptr if k is out of range
+**/
+DNode* DTree::select(int k) const {
+  if(_dense != nullptr){
+    if(k < 0 || k >= _dense->count){return nullptr;}
+    for(int page = 0; ; page++){
+      uint64_t bits = _dense->bits[page];
+      int count = __builtin_popcountll(bits);
+      if(k < count){
+        for(; k > 0; k--){bits &= bits - 1;}
+        return &_dense->pages[page][__builtin_ctzll(bits)];
+      }
+      k -= count;
+    }
+  }
+  if(_small != nullptr){
+    return (k < 0 || k >= _small->count) ? nullptr : _small->nodes[k];
+  }
+  DNode* node = _root;
+  while(node != nullptr && k >= 0){
+    int left = numLive(node->_left);
+    if(k < left){
+      node = node->_left;
+    }else if(k == left && !node->_vacant){
+      return node;
+    }else{
+      k -= left + (node->_vacant ? 0 : 1);
+      node = node->_right;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Counts the valid users with a discriminator between lo and hi. The range
+ * is clamped to the valid discriminators first, so hi + 1 can't overflow.
+ * @return number of non-vacant nodes with lo <= discriminator <= hi
+**/
+int DTree::countInRange(int lo, int hi) const {
+  lo = std::max(lo, MIN_DISC);
+  hi = std::min(hi, MAX_DISC);
+  if(lo > hi){return 0;}
+  return rank(hi + 1) - rank(lo);
+}
+
+/**
+ * Finds the smallest discriminator no valid user holds. Every subtree
+ * covers a known range of discriminators, so comparing that range's width
+ * with the subtree's valid users says whether it has a gap.
+ * @return lowest free discriminator, INVALID_DISC if all are taken
+**/
+int DTree::lowestFree() const {
+  return nthFree(0);
+}
+
+/**
+ * Finds the n-th free discriminator in increasing order, zero based.
+ * @return n-th free discriminator, INVALID_DISC if there are n or fewer
+**/
+int DTree::nthFree(int n) const {
+  if(n < 0 || n >= numFree()){return INVALID_DISC;}
+  if(_dense != nullptr){
+    for(int page = 0; ; page++){
+      int slots = std::min(DENSE_PAGE_SIZE, MAX_DISC - MIN_DISC + 1 - page * DENSE_PAGE_SIZE);
+      uint64_t free = ~_dense->bits[page];
+      if(slots < DENSE_PAGE_SIZE){free &= (uint64_t(1) << slots) - 1;}
+      int count = __builtin_popcountll(free);
+      if(n < count){
+        for(; n > 0; n--){free &= free - 1;}
+        return MIN_DISC + page * DENSE_PAGE_SIZE + __builtin_ctzll(free);
+      }
+      n -= count;
+    }
+  }
+  if(_small != nullptr){
+    //every taken discriminator at or below the candidate pushes it up one
+    int disc = MIN_DISC + n;
+    for(int i = 0; i < _small->count && _small->discs[i] <= disc; i++){
+      disc++;
+    }
+    return disc;
+  }
+  int lo = MIN_DISC;    //smallest discriminator the current subtree can hold
+  DNode* node = _root;
+  while(node != nullptr){
+    int disc = node->_account._disc;
+    int leftFree = (disc - lo) - numLive(node->_left);
+    if(n < leftFree){
+      node = node->_left;
+    }else{
+      n -= leftFree;
+      if(node->_vacant){
+        if(n == 0){return disc;}
+        n--;
+      }
+      lo = disc + 1;
+      node = node->_right;
+    }
+  }
+  return lo + n;
+}
+
+/**
+ * Finds the vacant node with the smallest discriminator, following the
+ * vacant counters so only subtrees holding one are entered. A dense tree
+ * has no vacant nodes, every free slot is as cheap to fill.
+ * @return discriminator of the lowest vacant node, INVALID_DISC if none
+**/
+int DTree::lowestVacant() const {
+  DNode* node = _root;
+  while(node != nullptr && node->_numVacant > 0){
+    if(node->_left != nullptr && node->_left->_numVacant > 0){
+      node = node->_left;
+    }else if(node->_vacant){
+      return node->_account._disc;
+    }else{
+      node = node->_right;
+    }
+  }
+  return INVALID_DISC;
 }
 
 /**
@@ -287,12 +761,12 @@ void DTree::updateNumVacant(DNode* node) {
 }
 
 /**
- * Checks for an imbalance, defined by 'Discord' rules, at the specified node.
+ * Checks for an imbalance, defined by the balance policy, at the specified node.
  * @param checkImbalance DNode object to inspect for an imbalance
  * @return (can change) returns true if an imbalance occured, false otherwise
 **/
 bool DTree::checkImbalance(DNode* node) {
-  //for imbalance, at least one child's size must be 4 or greater...
+  //for imbalance, at least one child's size must be the minimum or greater...
   int leftSize = 0;
   int rightSize = 0;
   if (node->_left != nullptr)
@@ -300,21 +774,39 @@ bool DTree::checkImbalance(DNode* node) {
   if (node->_right != nullptr)
     rightSize = node->_right->_size;
 
-  //  cout << "checking imbalance at " << node->_account._disc << endl;
-  //cout << "node's left child size: " << leftSize << " and right child: "
-  //   << rightSize << endl << endl;
-  
-  if(leftSize >= 4 || rightSize >=4){
-    //and the size of on`e child must be at least 50% bigger than the
-    //size of the other child
-    if(leftSize >= rightSize * 1.5 || rightSize >= leftSize * 1.5){
-      return true;
-    }else{
-      return false;
-    }
-  }else{
+  if(leftSize < _balance.minSize() && rightSize < _balance.minSize()){
     return false;
   }
+  long long num = _balance.num();
+  long long den = _balance.den();
+  if(_balance.rule() == BALANCE_DISCORD){
+    //and one child must be at least num/den times the size of the other
+    return leftSize * den >= rightSize * num || rightSize * den >= leftSize * num;
+  }
+  //or the heavier child must weigh more than num/den of the node
+  long long heavier = std::max(leftSize, rightSize) + 1;
+  return heavier * den > num * (leftSize + rightSize + 2);
+}
+
+/**
+ * Whether the node just inserted at disc is deeper than a scapegoat tree of
+ * this size allows, log base den/num of the size. Worked out in 20 bit fixed
+ * point, the size shrinking by num/den for every level.
+ * @param disc discriminator of the node just inserted
+ * @return true if its insert should rebuild
+**/
+bool DTree::tooDeep(int disc) const {
+  const uint64_t one = uint64_t(1) << 20;
+  uint64_t num = _balance.num();
+  uint64_t den = _balance.den();
+  uint64_t left = uint64_t(_root->_size) * one;
+  DNode* node = _root;
+  while(node != nullptr && node->_account._disc != disc){
+    left = left * num / den;
+    if(left < one){return true;}
+    node = (disc < node->_account._disc ? node->_left : node->_right);
+  }
+  return false;
 }
 
 
@@ -325,25 +817,16 @@ bool DTree::checkImbalance(DNode* node) {
 **/
 void DTree::rebalance(DNode*& node) {
   if(node!= nullptr){
-    DNode** tempArr = new DNode *[(node->_size - node->_numVacant)];
     int sizeArr = node->_size - node->_numVacant;
-    int count = 0;
-    int index = ((sizeArr-1)/2);
-    fillArr(tempArr, node, sizeArr, count);
-    
-    //set all left and right pointers in array at each node equal to null
-    // and set their sizes equal to 1.
-    for(int i = 0; i < sizeArr; i++){
-      tempArr[i]->_left = nullptr;
-      tempArr[i]->_right = nullptr;
-      //cout << tempArr[i]->_account._disc << ", ";
-    }
-    node = tempArr[index];
-    //set node equal to the middle element in the array, this will be the new root
-    //of the subtree.
-    fillTree(tempArr, tempArr[index], index, sizeArr); 
+    STATS_COUNT(rebuilds);
+    STATS_RECORD(rebuildSizes, sizeArr);
+    DNode** tempArr = new DNode *[sizeArr];
+    int index = 0;
+    fillArr(tempArr, node, sizeArr, index);
+    //the middle element of the array becomes the new root of the subtree,
+    //sizes are set as the tree is rebuilt.
+    node = fillTree(tempArr, 0, sizeArr - 1);
     delete [] tempArr;
-    helpUpdateSize(node);
   }
 }
 
@@ -358,101 +841,360 @@ void DTree::fillArr(DNode**& tempArr, DNode*& node, int count, int &index){
     if(node->isVacant()){
       fillArr(tempArr, node->_left, count, index);
       fillArr(tempArr, node->_right, count, index);
-      delete node;
+      STATS_COUNT(vacantReclaimed);
+      STATS_ADD(reclaimedBytes, sizeof(DNode) + heapBytes(node->_account));
+      _pool->destroy(node);
     }else{
       fillArr(tempArr, node->_left, count, index);
-      fillCell(tempArr, node, index++);
+      tempArr[index++] = node;
       fillArr(tempArr, node->_right, count, index);
     }
   }
 }
 
+/**
+ * Helper function for rebalance function.
+ * Links tempArr[first..last] into a perfectly balanced subtree and returns its root.
+**/
+DNode* DTree::fillTree(DNode** tempArr, int first, int last){
+  if(first > last){
+    return nullptr;
+  }
+  int mid = first + (last - first)/2;
+  DNode* node = tempArr[mid];
+  node->_left = fillTree(tempArr, first, mid - 1);
+  node->_right = fillTree(tempArr, mid + 1, last);
+  updateSize(node);
+  updateNumVacant(node);
+  return node;
+}
+
+
+/**
+ * Overloaded << operator for an Account to print out the account details
+ * @param sout ostream object
+ * @param acct Account objec to print
+ * @return ostream object containing stream of account details
+**/
 
-void DTree::fillCell(DNode **&tempArr, DNode*& node, int index){
-  tempArr[index] = node;
+ostream& operator<<(ostream& sout, const Account& acct) {
+    sout << "Account name: " << acct.getUsername() << 
+            "\n\tDiscriminator: " << acct.getDiscriminator() <<
+            "\n\tNitro: " << acct.hasNitro() << 
+            "\n\tBadge: " << acct.getBadge() << 
+            "\n\tStatus: " << acct.getStatus();
+    return sout;
 }
 
-void DTree::fillTree(DNode **&tempArr, DNode*& node, int &index, int size){
-  if(size == 1){
-    return;
+/**
+ * Moves every valid user out of the nodes into the dense bitmap and pages,
+ * then frees the nodes. Vacant nodes are dropped.
+**/
+void DTree::makeDense(){
+  DenseDiscs* dense = new DenseDiscs();
+  dense->username = getUsername();
+  dense->count = 0;
+  _dense = dense;
+  auto move = [this](DNode* node){insertDense(node->_account);};
+  forEachUser(_root, move);
+  dropNodes();
+}
+
+/**
+ * Frees every node once their accounts have been moved elsewhere.
+**/
+void DTree::dropNodes(){
+  DNode* root = _root;
+  _root = nullptr;
+  if(_ownsPool){
+    _pool->release();
+  }else{
+    clearTree(root);
   }
-  if(size == 2){
-    node->_left = tempArr[0];
+}
+
+/**
+ * Moves every valid user out of the dense pages or small arrays into a
+ * balanced node tree. A small tree's nodes are linked up where they are.
+**/
+void DTree::makeSparse(){
+  if(_small != nullptr){
+    dropRemoved();
+    std::vector<DNode*> nodes = std::move(_small->nodes);
+    delete _small;
+    _small = nullptr;
+    _root = fillTree(nodes.data(), 0, int(nodes.size()) - 1);
     return;
   }
-  if (size == 3){
-    node->_left = tempArr[0];
-    node->_right = tempArr[2];
-    return;
+  std::vector<Account> accts;
+  accts.reserve(getNumUsers());
+  forEachUser([&accts](DNode* node){accts.push_back(std::move(node->_account));});
+  clear();
+  buildNodes(accts.data(), accts.size());
+}
+
+void DTree::clearDense(){
+  if(_dense == nullptr){return;}
+  for(int page = 0; page < DENSE_PAGES; page++){
+    delete [] _dense->pages[page];
   }
-  if(index == 0){
-    index ++;
-    int filled = fillInnerNodes(tempArr, node, index, size);
-    index = (size+1)/2; //send in the root node and the index for the first element on the right
-    return fillTree(tempArr, tempArr[(size-1)/2], index, size);
-  }else if(index != 0 && index != size - 1){
-    //half the left side of the tree
-    if(index <= (size-1)/2){
-      index = (index-1)/2;
-      node->_left = tempArr[index];
-      return fillTree(tempArr, node->_left, index, size);
-    }else{ //half the right side of the tree
-      index = (size+index)/2;
-      node->_right = tempArr[index];
-      return fillTree(tempArr, node->_right, index, size);
+  delete _dense;
+  _dense = nullptr;
+}
+
+/**
+ * Finds the slot of a valid user in a dense tree.
+ * @return slot holding disc, nullptr if disc is not a valid user
+**/
+DNode* DTree::denseSlot(int disc) const{
+  int index = disc - MIN_DISC;
+  if(index < 0 || index > MAX_DISC - MIN_DISC){return nullptr;}
+  int page = index / DENSE_PAGE_SIZE;
+  if(!(_dense->bits[page] & (uint64_t(1) << (index % DENSE_PAGE_SIZE)))){return nullptr;}
+  return &_dense->pages[page][index % DENSE_PAGE_SIZE];
+}
+
+bool DTree::insertDense(Account& newAcct){
+  int index = newAcct._disc - MIN_DISC;
+  int page = index / DENSE_PAGE_SIZE;
+  uint64_t bit = uint64_t(1) << (index % DENSE_PAGE_SIZE);
+  if(_dense->bits[page] & bit){return false;}
+  if(_dense->pages[page] == nullptr){
+    _dense->pages[page] = new DNode[DENSE_PAGE_SIZE];
+  }
+  DNode& slot = _dense->pages[page][index % DENSE_PAGE_SIZE];
+  slot._account = std::move(newAcct);
+  slot._vacant = false;
+  _dense->bits[page] |= bit;
+  _dense->count++;
+  return true;
+}
+
+/**
+ * Rebuilds the highest subtree on the path to disc that is at least the
+ * compaction percent vacant and within the compaction budget, dropping its
+ * vacant nodes. Bounding the subtree bounds the work any one remove does,
+ * while every subtree a remove-heavy workload keeps hitting gets compacted.
+ * @param disc discriminator whose search path is checked
+**/
+void DTree::compactPath(int disc){
+  int percent = _compaction.percent();
+  int budget = _compaction.budget();
+  if(percent <= 0){return;}
+  DNode** slot = &_root;
+  while(*slot != nullptr){
+    DNode* node = *slot;
+    if(node->_size >= COMPACT_MIN_SIZE && node->_size <= budget
+       && node->_numVacant * 100 >= percent * node->_size){
+      int reclaimed = node->_numVacant;
+      rebalance(*slot);
+      updatePath(disc, *slot, reclaimed);
+      return;
     }
-  }else{
-    index --;
-    int filled = fillInnerNodes(tempArr, node, index, size);
-    if(filled){return;}
+    if(disc == node->_account._disc){
+      return;
+    }
+    slot = (disc < node->_account._disc ? &node->_left : &node->_right);
   }
 }
 
-bool DTree::fillInnerNodes(DNode **&tempArr, DNode*& node, int &index, int size){
-  //when the root of the subtree is reached, the left or right side is filled.
-  if(index == (size-1)/2){
-    return true;
+/**
+ * Rebuilds the whole tree without its vacant nodes, whatever the budget.
+ * Meant for idle time or a maintenance thread that owns the tree.
+ * @return number of vacant nodes dropped
+**/
+int DTree::compact(){
+  if(_root == nullptr || _root->_numVacant == 0){return 0;}
+  int reclaimed = _root->_numVacant;
+  rebalance(_root);
+  return reclaimed;
+}
+
+CompactPolicy::CompactPolicy(int percent, int budget){
+  if(percent < 0 || percent > 100 || budget < 0){
+    throw std::invalid_argument("CompactPolicy: compacting at " + std::to_string(percent) + "% with a budget of "
+                                + std::to_string(budget) + " nodes is not possible");
   }
-  //fills the left side of the tree
-  if(index < (size-1)/2){
-    if(tempArr[index]->_left != nullptr){
-      index++;
-      int retValue = fillInnerNodes(tempArr, tempArr[index-1], index, size);
-      if (retValue){
-	return false;
-      }
-    }else{
-      node->_right = tempArr[index];
-      index++;
-      int retValue =  fillInnerNodes(tempArr, node->_right, index, size);
-      if (retValue){return false;}
-    }
-  }else{ //fills the right side if the tree
-    if(tempArr[index]->_right != nullptr){
-      index--;
-      return fillInnerNodes(tempArr, tempArr[index+1], index, size);
-    }else{
-      node->_left = tempArr[index];
-      index--;
-      return fillInnerNodes(tempArr, node->_left, index, size);
+  _percent = percent;
+  _budget = budget;
+}
+
+BalancePolicy::BalancePolicy(int rule, int minSize, int num, int den){
+  if(rule != BALANCE_DISCORD && rule != BALANCE_WEIGHT && rule != BALANCE_SCAPEGOAT){
+    throw std::invalid_argument("BalancePolicy: unknown balance rule " + std::to_string(rule));
+  }
+  bool ratio = (rule == BALANCE_DISCORD ? num > den : 2 * num > den && num < den);
+  if(minSize < 0 || den <= 0 || num > BALANCE_MAX_TERM || den > BALANCE_MAX_TERM || !ratio){
+    throw std::invalid_argument("BalancePolicy: " + std::to_string(num) + "/" + std::to_string(den)
+                                + " is not a ratio this rule can use");
+  }
+  _rule = rule;
+  _minSize = minSize;
+  _num = num;
+  _den = den;
+}
+
+/**
+ * Lists every valid user's node in the small arrays, keeping the nodes
+ * where they are. Vacant nodes are dropped.
+**/
+void DTree::makeSmall(){
+  SmallDiscs* small = new SmallDiscs{getUsername(), 0, {}, {}, nullptr};
+  small->nodes.reserve(numLive(_root));
+  auto list = [small](DNode* node){
+    small->discs.push_back(node->_account._disc);
+    small->nodes.push_back(node);
+    small->count++;
+  };
+  forEachUser(_root, list);
+  small->discs.resize((small->count + SMALL_LANES - 1) / SMALL_LANES * SMALL_LANES, INVALID_DISC);
+  detachNodes(_root);
+  _root = nullptr;
+  _small = small;
+}
+
+/**
+ * Helper for makeSmall, unlinks every node of the subtree, freeing the
+ * vacant ones.
+**/
+void DTree::detachNodes(DNode* node){
+  if(node == nullptr){return;}
+  detachNodes(node->_left);
+  detachNodes(node->_right);
+  if(node->_vacant){
+    _pool->destroy(node);
+  }else{
+    node->_left = nullptr;
+    node->_right = nullptr;
+    node->_size = DEFAULT_SIZE;
+    node->_numVacant = DEFAULT_NUM_VACANT;
+  }
+}
+
+/**
+ * Lets go of every node without freeing any, for a UTree about to release
+ * the whole shared pool.
+**/
+void DTree::forgetNodes(){
+  delete _small;
+  _small = nullptr;
+  _root = nullptr;
+}
+
+/**
+ * Frees the node of a small tree's last removed user.
+**/
+void DTree::dropRemoved(){
+  _pool->destroy(_small->removed);
+  _small->removed = nullptr;
+}
+
+/**
+ * Helper function for buildFromSorted, fills the small arrays straight from
+ * the sorted accounts. The tree must be empty.
+**/
+void DTree::buildSmall(Account* first, int count){
+  _small = new SmallDiscs{first[0]._username, 0, {}, {}, nullptr};
+  _small->discs.reserve((count + SMALL_LANES - 1) / SMALL_LANES * SMALL_LANES);
+  _small->nodes.reserve(count);
+  for(int i = 0; i < count; i++){
+    if(_small->count > 0 && _small->discs[_small->count - 1] == first[i]._disc){
+      continue;
     }
-    
+    _small->discs.push_back(first[i]._disc);
+    _small->nodes.push_back(_pool->create(std::move(first[i])));
+    _small->count++;
   }
+  _small->discs.resize((_small->count + SMALL_LANES - 1) / SMALL_LANES * SMALL_LANES, INVALID_DISC);
 }
 
+bool DTree::insertSmall(Account& newAcct){
+  SmallDiscs& small = *_small;
+  int disc = newAcct._disc;
+  int index = std::lower_bound(small.discs.data(), small.discs.data() + small.count, disc) - small.discs.data();
+  if(index < small.count && small.discs[index] == disc){return false;}
+  dropRemoved();
+  if(small.count == int(small.discs.size())){
+    small.discs.resize(small.count + SMALL_LANES, INVALID_DISC);
+  }
+  int16_t* discs = small.discs.data();
+  std::copy_backward(discs + index, discs + small.count, discs + small.count + 1);
+  discs[index] = disc;
+  small.nodes.insert(small.nodes.begin() + index, _pool->create(std::move(newAcct)));
+  small.count++;
+  return true;
+}
 
 /**
- * Overloaded << operator for an Account to print out the account details
- * @param sout ostream object
- * @param acct Account objec to print
- * @return ostream object containing stream of account details
+ * Takes disc out of the small arrays. The removed node stays allocated
+ * until the next insert or remove.
 **/
+bool DTree::removeSmall(int disc, DNode*& removed){
+  SmallDiscs& small = *_small;
+  int index = smallFind()(small.discs.data(), small.count, disc);
+  if(index < 0){return false;}
+  dropRemoved();
+  int16_t* discs = small.discs.data();
+  std::copy(discs + index + 1, discs + small.count, discs + index);
+  small.count--;
+  discs[small.count] = INVALID_DISC;
+  removed = small.nodes[index];
+  small.nodes.erase(small.nodes.begin() + index);
+  removed->_vacant = true;
+  small.removed = removed;
+  return true;
+}
 
-ostream& operator<<(ostream& sout, const Account& acct) {
-    sout << "Account name: " << acct.getUsername() << 
-            "\n\tDiscriminator: " << acct.getDiscriminator() <<
-            "\n\tNitro: " << acct.hasNitro() << 
-            "\n\tBadge: " << acct.getBadge() << 
-            "\n\tStatus: " << acct.getStatus();
-    return sout;
+/**
+ * Finds disc among the first count entries of a small tree's discriminators.
+ * The array is padded with INVALID_DISC to a multiple of SMALL_LANES, so
+ * the vector versions compare whole registers without reading past it.
+ * Discriminators out of range can't be in the array, and could match the
+ * padding or wrap around in a 16 bit lane, so they are turned away first.
+ * @return index of disc, -1 if it isn't there
+**/
+int DTree::findScalar(const int16_t* discs, int count, int disc){
+  for(int i = 0; i < count && discs[i] <= disc; i++){
+    if(discs[i] == disc){return i;}
+  }
+  return -1;
+}
+
+#ifdef DTREE_X86
+int DTree::findSSE2(const int16_t* discs, int count, int disc){
+  if(disc < MIN_DISC || disc > MAX_DISC){return -1;}
+  __m128i key = _mm_set1_epi16(disc);
+  for(int i = 0; i < count; i += 8){
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(discs + i));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, key));
+    if(mask != 0){return i + __builtin_ctz(mask) / 2;}
+  }
+  return -1;
+}
+
+__attribute__((target("avx2")))
+int DTree::findAVX2(const int16_t* discs, int count, int disc){
+  if(disc < MIN_DISC || disc > MAX_DISC){return -1;}
+  __m256i key = _mm256_set1_epi16(disc);
+  for(int i = 0; i < count; i += 16){
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(discs + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(chunk, key));
+    if(mask != 0){return i + __builtin_ctz(mask) / 2;}
+  }
+  return -1;
+}
+#else
+int DTree::findSSE2(const int16_t* discs, int count, int disc){
+  return findScalar(discs, count, disc);
+}
+
+int DTree::findAVX2(const int16_t* discs, int count, int disc){
+  return findScalar(discs, count, disc);
+}
+#endif
+
+const char* DTree::smallSearch(){
+  if(smallFind() == findAVX2){return "avx2";}
+  if(smallFind() == findSSE2){return "sse2";}
+  return "scalar";
 }
@@ -2,7 +2,13 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <vector>
 #include <exception>
+#include <cstdint>
+#include <atomic>
+#include <iterator>
+#include "nodepool.h"
 
 using std::cout;
 using std::endl;
@@ -19,6 +25,47 @@ using std::ostream;
 #define DEFAULT_SIZE 1
 #define DEFAULT_NUM_VACANT 0
 
+/* Dense mode, a DTree this full keeps its accounts in an array indexed by
+ * discriminator instead of in nodes. The gap between the two thresholds
+ * keeps a tree near one of them from switching back and forth */
+#define DENSE_ENTER 5000        /* valid users at which a DTree goes dense */
+#define DENSE_LEAVE 2500        /* valid users below which it goes back to nodes */
+#define DENSE_PAGE_SIZE 64      /* slots per page, one bitmap word per page */
+#define DENSE_PAGES ((MAX_DISC - MIN_DISC) / DENSE_PAGE_SIZE + 1)
+
+/* Small mode, a DTree inside a UTree with no more than SMALL_CUTOFF users
+ * keeps their discriminators in one sorted int16 array, searched with SIMD
+ * compares, and their accounts in a parallel array. It turns into nodes when
+ * an insert would pass the cutoff and back when a remove finds no more than
+ * SMALL_LEAVE users */
+#define SMALL_CUTOFF 64
+#define SMALL_LEAVE 32
+#define SMALL_LANES 16          /* discriminator array is padded to a multiple of this */
+
+/* Compaction, a remove first rebuilds the highest subtree on its path that
+ * is at least COMPACT_PERCENT vacant, if it has no more than COMPACT_BUDGET
+ * nodes. Each DTree keeps its own CompactPolicy, set with
+ * DTree::setCompaction or for a whole tree with UTree::setCompaction */
+#define COMPACT_PERCENT 50
+#define COMPACT_BUDGET 4096
+#define COMPACT_MIN_SIZE 8      /* smaller subtrees are not worth a rebuild */
+
+/* Balance policies, the rule an insert checks at every node on its way back
+ * up. A subtree is only rebuilt once a child holds at least the minimum
+ * size, and every rule takes its ratio as an integer num / den. Each DTree
+ * keeps its own BalancePolicy, set with DTree::setBalance or for a whole
+ * tree with UTree::setBalance */
+#define BALANCE_DISCORD 0       /* a child at least num/den times the size of the other */
+#define BALANCE_WEIGHT 1        /* a child weighs more than num/den of the node, weights
+                                 * being size + 1 and num/den between 1/2 and 1 */
+#define BALANCE_SCAPEGOAT 2     /* as BALANCE_WEIGHT, but only an insert deeper than
+                                 * log base den/num of the tree size rebuilds, at its
+                                 * lowest unbalanced ancestor */
+#define BALANCE_MIN_SIZE 4
+#define BALANCE_NUM 3
+#define BALANCE_DEN 2
+#define BALANCE_MAX_TERM 1024   /* largest num or den, keeps the products in range */
+
 class Grader;   /* For grading purposes */
 class Tester;   /* Forward declaration for testing class */
 
@@ -41,19 +88,19 @@ public:
             throw std::out_of_range("Discriminator out of valid range (" + std::to_string(MIN_DISC) 
                                     + "-" + std::to_string(MAX_DISC) + ")");
         }
-        _username = username;
+        _username = std::move(username);
         _disc = disc;
         _nitro = nitro;
-        _badge = badge;
-        _status = status;
+        _badge = std::move(badge);
+        _status = std::move(status);
     }
 
     /* Getters */
-    string getUsername() const {return _username;}
+    const string& getUsername() const {return _username;}
     int getDiscriminator() const {return _disc;}
     bool hasNitro() const {return _nitro;}
-    string getBadge() const {return _badge;}
-    string getStatus() const {return _status;}
+    const string& getBadge() const {return _badge;}
+    const string& getStatus() const {return _status;}
 
 private:
     string _username;
@@ -66,10 +113,55 @@ private:
 /* Overloaded << operator to print Accounts */
 ostream& operator<<(ostream& sout, const Account& acct);
 
+/**
+ * A balance rule and the ratio it uses, checked once when it is made so a
+ * DTree never sees a rule with another rule's ratio.
+**/
+class BalancePolicy {
+public:
+    BalancePolicy(): _rule(BALANCE_DISCORD), _minSize(BALANCE_MIN_SIZE), _num(BALANCE_NUM), _den(BALANCE_DEN) {}
+    /* Throws std::invalid_argument for an unknown rule or a ratio it can't use */
+    BalancePolicy(int rule, int minSize, int num, int den);
+
+    int rule() const {return _rule;}
+    int minSize() const {return _minSize;}
+    int num() const {return _num;}
+    int den() const {return _den;}
+
+private:
+    int _rule;
+    int _minSize;
+    int _num;
+    int _den;
+};
+
+/**
+ * How vacant a subtree has to be before a remove rebuilds it, and the
+ * largest subtree it will rebuild. A percent of 0 turns compaction on
+ * remove off.
+**/
+class CompactPolicy {
+public:
+    CompactPolicy(): _percent(COMPACT_PERCENT), _budget(COMPACT_BUDGET) {}
+    /* Throws std::invalid_argument for a percent outside 0-100 or a
+     * negative budget */
+    CompactPolicy(int percent, int budget);
+
+    int percent() const {return _percent;}
+    int budget() const {return _budget;}
+
+private:
+    int _percent;
+    int _budget;
+};
+
 class DNode {
     friend class Grader;
     friend class Tester;
     friend class DTree;
+    friend class UTree;
+    friend class Snapshot;
+    friend class ShardedUTree;
 
 public:
     DNode() {
@@ -81,7 +173,7 @@ public:
     }
 
     DNode(Account account) {
-        _account = account;
+        _account = std::move(account);
         _size = DEFAULT_SIZE;
         _numVacant = DEFAULT_NUM_VACANT;
         _vacant = false;
@@ -90,11 +182,11 @@ public:
     }
 
     /* Getters */
-    Account getAccount() const {return _account;}
+    const Account& getAccount() const {return _account;}
     int getSize() const {return _size;}
     int getNumVacant() const {return _numVacant;}
     bool isVacant() const {return _vacant;}
-    string getUsername() const {return _account.getUsername();}
+    const string& getUsername() const {return _account.getUsername();}
     int getDiscriminator() const {return _account.getDiscriminator();}
 
 private:
@@ -110,9 +202,51 @@ private:
 class DTree {
     friend class Grader;
     friend class Tester;
+    friend class UTree;
+    friend class Snapshot;
+    friend class ShardedUTree;
 
 public:
-    DTree(): _root(nullptr) {}
+    /* Forward iterator over the valid users' accounts in discriminator
+     * order. A node tree is walked with an explicit stack, skipping vacant
+     * nodes and subtrees with no valid users. Any change to the tree
+     * invalidates its iterators */
+    class const_iterator {
+        friend class DTree;
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Account value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Account* pointer;
+        typedef const Account& reference;
+
+        const_iterator(): _tree(nullptr), _node(nullptr), _index(0) {}
+        reference operator*() const {return _node->_account;}
+        pointer operator->() const {return &_node->_account;}
+        const_iterator& operator++();
+        const_iterator operator++(int) {const_iterator old = *this; ++*this; return old;}
+        bool operator==(const const_iterator& rhs) const {return _node == rhs._node;}
+        bool operator!=(const const_iterator& rhs) const {return _node != rhs._node;}
+
+    private:
+        const DTree* _tree;
+        DNode* _node;                 /* current user, nullptr at the end */
+        int _index;                   /* position of _node in a small or dense tree */
+        std::vector<DNode*> _stack;   /* nodes still to visit in a node tree */
+
+        void pushLeft(DNode* node);
+        void nextNode();
+        void nextDense(int index);
+    };
+
+    /* A DTree on its own owns its node pool, a DTree inside a UTree
+     * shares the UTree's pool and policies and uses small mode */
+    DTree(): _root(nullptr), _dense(nullptr), _small(nullptr), _pool(new NodePool<DNode>()),
+             _ownsPool(true), _smallMode(false) {}
+    DTree(NodePool<DNode>* pool, const BalancePolicy& balance = BalancePolicy(),
+          const CompactPolicy& compaction = CompactPolicy()):
+        _root(nullptr), _dense(nullptr), _small(nullptr), _pool(pool), _ownsPool(false), _smallMode(true),
+        _balance(balance), _compaction(compaction) {}
 
     /* destructor and assignment operator */
     ~DTree();
@@ -121,17 +255,53 @@ public:
     /* Basic operations */
 
     bool insert(Account newAcct);
+    void buildFromSorted(std::vector<Account> sorted);
     bool remove(int disc, DNode*& removed);
-    DNode* retrieve(int disc);
+    DNode* retrieve(int disc) const;
     void clear();
     void printAccounts() const;
-    void dump() const {dump(_root);}
+    const_iterator begin() const;
+    const_iterator end() const {return const_iterator();}
+    void dump() const;
     void dump(DNode* node) const;
 
     /* "Helper" functions */
     
     int getNumUsers() const;
-    string getUsername() const {return _root->getUsername();}
+    /* Mean nodes a retrieve of a valid user compares against, a small tree
+     * search counts as one and a dense slot as none */
+    double averageDepth() const;
+    /* Order statistics over the non-vacant nodes */
+    int rank(int disc) const;
+    DNode* select(int k) const;
+    int countInRange(int lo, int hi) const;
+
+    /* Discriminators between MIN_DISC and MAX_DISC no valid user holds,
+     * INVALID_DISC if there is none */
+    int numFree() const {return MAX_DISC - MIN_DISC + 1 - getNumUsers();}
+    int lowestFree() const;
+    int nthFree(int n) const;
+    int lowestVacant() const;
+
+    const string& getUsername() const;
+    bool isDense() const {return _dense != nullptr;}
+    bool isSmall() const {return _small != nullptr;}
+    /* Which small tree search this CPU runs: "avx2", "sse2" or "scalar" */
+    static const char* smallSearch();
+
+    /* Drops every vacant node now, returns the number dropped */
+    int compact();
+    /* When later removes from this tree compact it */
+    void setCompaction(const CompactPolicy& compaction) {_compaction = compaction;}
+    const CompactPolicy& getCompaction() const {return _compaction;}
+
+    /* Rule later inserts into this tree rebalance by */
+    void setBalance(const BalancePolicy& balance) {_balance = balance;}
+    const BalancePolicy& getBalance() const {return _balance;}
+
+    /* Calls visit on every valid user's DNode in discriminator order */
+    template <class Visit>
+    void forEachUser(Visit visit) const;
     void updateSize(DNode* node);
     void updateNumVacant(DNode* node);
     bool checkImbalance(DNode* node);
@@ -139,20 +309,94 @@ public:
     void printRoot(DTree& node);
   
 private:
+  /* Occupancy bitmap plus pages of DNodes indexed by discriminator.
+   * Pages are only allocated once a discriminator in them is used */
+  struct DenseDiscs {
+    string username;
+    int count;
+    uint64_t bits[DENSE_PAGES];
+    DNode* pages[DENSE_PAGES];
+  };
+
+  /* Sorted discriminators and their nodes. The nodes come from the pool
+   * and keep their addresses, only the pointers move */
+  struct SmallDiscs {
+    string username;
+    int count;
+    std::vector<int16_t> discs;   /* padded with INVALID_DISC */
+    std::vector<DNode*> nodes;
+    DNode* removed;               /* last removed, freed by the next change */
+  };
+  typedef int (*SmallFind)(const int16_t* discs, int count, int disc);
+
+
   DNode* _root;
+  DenseDiscs* _dense;     /* nullptr while the tree is made of nodes */
+  SmallDiscs* _small;     /* nullptr unless the tree is in small mode */
+  NodePool<DNode>* _pool;
+  bool _ownsPool;
+  bool _smallMode;        /* whether the tree may use small mode */
+  BalancePolicy _balance;
+  CompactPolicy _compaction;
+  static SmallFind smallFind();
   void clearTree(DNode* node);
-  bool insert(Account newAcct, DNode*& node);
-  DNode* retrieve(int disc, DNode* node);
-  void printAccounts(DNode* node) const;
+  bool insert(Account& newAcct, DNode*& node, DNode**& imbalanced);
+  void buildFromSorted(Account* first, int count);
+  void buildNodes(Account* first, int count);
+  bool fitsVacant(int disc, DNode* node);
+  void updatePath(int disc, DNode* stop, int reclaimed);
+  DNode* retrieve(int disc, DNode* node) const;
   void makeDeep(const DNode* rhs, DNode*& node);
   DNode* findNode(int disc, DNode*& node);
   void updateParents(int disc, DNode*& parent);
   void fillArr(DNode **&tempArr, DNode*& node, int count, int &index);
   void rebalanceSub(DNode*& node);  
   DNode* findMin(DNode* node);
-  void helpUpdateSize(DNode* node);
-  void helpCheckBalance(DNode*& node);
-  void fillTree(DNode**& tempArr, DNode*& node, int &index, int size);
-  void fillCell(DNode**& tempArr, DNode*& node, int index);
-  bool fillInnerNodes(DNode**& tempArr, DNode*& node, int &index, int size);  
+  DNode* fillTree(DNode** tempArr, int first, int last);
+  static int numLive(DNode* node) {return node == nullptr ? 0 : node->_size - node->_numVacant;}
+  template <class Visit>
+  static void forEachUser(DNode* node, Visit& visit);
+  void compactPath(int disc);
+  bool tooDeep(int disc) const;
+  void makeDense();
+  void makeSparse();
+  void clearDense();
+  DNode* denseSlot(int disc) const;
+  bool insertDense(Account& newAcct);
+  void dropNodes();
+  void makeSmall();
+  void detachNodes(DNode* node);
+  void dropRemoved();
+  void forgetNodes();
+  void buildSmall(Account* first, int count);
+  bool insertSmall(Account& newAcct);
+  bool removeSmall(int disc, DNode*& removed);
+  static int findScalar(const int16_t* discs, int count, int disc);
+  static int findSSE2(const int16_t* discs, int count, int disc);
+  static int findAVX2(const int16_t* discs, int count, int disc);
 };
+
+template <class Visit>
+void DTree::forEachUser(Visit visit) const {
+  if(_dense != nullptr){
+    for(int page = 0; page < DENSE_PAGES; page++){
+      for(uint64_t bits = _dense->bits[page]; bits != 0; bits &= bits - 1){
+        visit(&_dense->pages[page][__builtin_ctzll(bits)]);
+      }
+    }
+  }else if(_small != nullptr){
+    for(int i = 0; i < _small->count; i++){
+      visit(_small->nodes[i]);
+    }
+  }else{
+    forEachUser(_root, visit);
+  }
+}
+
+template <class Visit>
+void DTree::forEachUser(DNode* node, Visit& visit) {
+  if(node == nullptr){return;}
+  forEachUser(node->_left, visit);
+  if(!node->_vacant){visit(node);}
+  forEachUser(node->_right, visit);
+}
@@ -0,0 +1,136 @@
+#include "exportsink.h"
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+FileSink::FileSink(const string& path, size_t bufferSize):
+    _buffer(new char[bufferSize]), _capacity(bufferSize), _used(0) {
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(_fd < 0) {
+        delete [] _buffer;
+        throw std::runtime_error("FileSink: " + path + " could not be opened or created");
+    }
+}
+
+/**
+ * Writes out whatever is still buffered.
+ */
+FileSink::~FileSink() {
+    try {
+        flush();
+    } catch(const std::exception& e) {
+        std::cerr << __FUNCTION__ << ": " << e.what() << endl;
+    }
+    close(_fd);
+    delete [] _buffer;
+}
+
+void FileSink::write(const char* data, size_t size) {
+    if(size <= _capacity - _used) {
+        memcpy(_buffer + _used, data, size);
+        _used += size;
+        return;
+    }
+    /* buffer and data go out together, retrying whatever a short write left */
+    struct iovec parts[2] = {{_buffer, _used}, {const_cast<char*>(data), size}};
+    struct iovec* part = parts;
+    int count = 2;
+    while(count > 0) {
+        ssize_t written = writev(_fd, part, count);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            throw std::runtime_error("FileSink: write failed");
+        }
+        while(count > 0 && size_t(written) >= part->iov_len) {
+            written -= part->iov_len;
+            part++;
+            count--;
+        }
+        if(count > 0) {
+            part->iov_base = static_cast<char*>(part->iov_base) + written;
+            part->iov_len -= written;
+        }
+    }
+    _used = 0;
+}
+
+void FileSink::flush() {
+    writeAll(_buffer, _used);
+    _used = 0;
+}
+
+void FileSink::sync() {
+    flush();
+    if(fdatasync(_fd) != 0) throw std::runtime_error("FileSink: sync failed");
+}
+
+void FileSink::writeAll(const char* data, size_t size) {
+    while(size > 0) {
+        ssize_t written = ::write(_fd, data, size);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            throw std::runtime_error("FileSink: write failed");
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+/**
+ * Appends a line loadData reads back as acct. loadData splits on every
+ * comma and line, so fields holding either can't be exported as CSV.
+ */
+void appendCsv(string& out, const Account& acct) {
+    for(const string* field : {&acct.getUsername(), &acct.getBadge(), &acct.getStatus()}) {
+        if(field->find_first_of(",\n") != string::npos) {
+            throw std::invalid_argument("appendCsv: field \"" + *field + "\" holds a comma or newline");
+        }
+    }
+    char digits[16];
+    out += acct.getUsername();
+    out += ',';
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), acct.getDiscriminator()).ptr);
+    out += acct.hasNitro() ? ",1," : ",0,";
+    out += acct.getBadge();
+    out += ',';
+    out += acct.getStatus();
+    out += '\n';
+}
+
+/**
+ * Appends str as a quoted JSON string.
+ */
+static void appendJsonString(string& out, std::string_view str) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for(char c : str) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if(static_cast<unsigned char>(c) < 0x20) {
+            out += "\\u00";
+            out += hex[c >> 4];
+            out += hex[c & 0xf];
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+void appendJson(string& out, const Account& acct) {
+    char digits[16];
+    out += "{\"username\":";
+    appendJsonString(out, acct.getUsername());
+    out += ",\"disc\":";
+    out.append(digits, std::to_chars(digits, digits + sizeof(digits), acct.getDiscriminator()).ptr);
+    out += acct.hasNitro() ? ",\"nitro\":true,\"badge\":" : ",\"nitro\":false,\"badge\":";
+    appendJsonString(out, acct.getBadge());
+    out += ",\"status\":";
+    appendJsonString(out, acct.getStatus());
+    out += "}\n";
+}
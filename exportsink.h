@@ -0,0 +1,68 @@
+#pragma once
+
+#include "dtree.h"
+#include <cstddef>
+#include <string_view>
+
+/* UTree::exportTo formats */
+#define EXPORT_CSV 0            /* one line per account, read back by loadData */
+#define EXPORT_JSON 1           /* one JSON object per line */
+#define EXPORT_SNAPSHOT 2       /* the snapshot layout, read back by loadSnapshot */
+
+#define EXPORT_BUFFER_SIZE (1 << 20)    /* bytes a FileSink gathers before writing */
+
+/**
+ * Destination of an export. Bytes handed to write only have to stay valid
+ * for the call, a sink copies or writes them before it returns.
+ */
+class ExportSink {
+public:
+    virtual ~ExportSink() {}
+    virtual void write(const char* data, size_t size) = 0;
+    /* Passes on everything written so far */
+    virtual void flush() {}
+};
+
+/**
+ * Sink into a file through one preallocated buffer. Small writes are copied
+ * into the buffer, a write that doesn't fit goes out with the buffer in one
+ * writev, so large sections are never copied.
+ */
+class FileSink : public ExportSink {
+public:
+    /* Creates or truncates path, throws std::runtime_error if it can't */
+    FileSink(const string& path, size_t bufferSize = EXPORT_BUFFER_SIZE);
+    ~FileSink();
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    void write(const char* data, size_t size) override;
+    void flush() override;
+    /* Flushes and waits for the data to reach the disk */
+    void sync();
+
+private:
+    int _fd;
+    char* _buffer;
+    size_t _capacity;
+    size_t _used;
+
+    void writeAll(const char* data, size_t size);
+};
+
+/**
+ * Sink into a string, for exports that stay in memory.
+ */
+class StringSink : public ExportSink {
+public:
+    void write(const char* data, size_t size) override {_data.append(data, size);}
+    const string& data() const {return _data;}
+
+private:
+    string _data;
+};
+
+/* Appends acct to out in an export format */
+void appendCsv(string& out, const Account& acct);
+void appendJson(string& out, const Account& acct);
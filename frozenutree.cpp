@@ -0,0 +1,102 @@
+#include "frozenutree.h"
+#include <cstring>
+
+/**
+ * Copies every valid account of utree into the frozen layout.
+ */
+FrozenUTree::FrozenUTree(const UTree& utree) {
+    std::vector<UNode*> stack;
+    _first.push_back(0);
+    for(UNode* node = utree._root; node != nullptr || !stack.empty(); node = node->_right) {
+        for(; node != nullptr; node = node->_left) stack.push_back(node);
+        node = stack.back();
+        stack.pop_back();
+        _names.push_back(node->_username);
+        node->_dtree->forEachUser([this](DNode* dnode) {
+            _discs.push_back(dnode->getDiscriminator());
+            _accounts.push_back(dnode->getAccount());
+        });
+        _first.push_back(_accounts.size());
+    }
+
+    _keys.resize(_names.size() + 1);
+    _users.resize(_names.size() + 1);
+    uint32_t next = 0;
+    fillKeys(1, next);
+}
+
+/**
+ * Helper function for the constructor.
+ * Walks the implicit tree in order, handing out usernames in sorted order.
+ */
+void FrozenUTree::fillKeys(uint32_t slot, uint32_t& next) {
+    if(slot >= _keys.size()) return;
+    fillKeys(2 * slot, next);
+    _keys[slot] = makeKey(_names[next]);
+    _users[slot] = next++;
+    fillKeys(2 * slot + 1, next);
+}
+
+/**
+ * First 16 bytes of a username as two big-endian words, zero padded.
+ * Comparing keys as integers orders them like the strings.
+ */
+FrozenUTree::Key FrozenUTree::makeKey(std::string_view username) {
+    unsigned char bytes[16] = {};
+    memcpy(bytes, username.data(), username.size() < 16 ? username.size() : 16);
+    uint64_t hi, lo;
+    memcpy(&hi, bytes, 8);
+    memcpy(&lo, bytes + 8, 8);
+    return Key{__builtin_bswap64(hi), __builtin_bswap64(lo)};
+}
+
+/**
+ * Is the username at slot ordered before the one being searched for.
+ */
+bool FrozenUTree::less(uint32_t slot, const Key& key, std::string_view username) const {
+    const Key& at = _keys[slot];
+    if(__builtin_expect(at.hi == key.hi && at.lo == key.lo, 0)) {
+        return std::string_view(_names[_users[slot]]) < username;
+    }
+    return (at.hi < key.hi) | ((at.hi == key.hi) & (at.lo < key.lo));
+}
+
+/**
+ * Index of username in _names, -1 if it is not there.
+ */
+int FrozenUTree::find(std::string_view username) const {
+    const Key key = makeKey(username);
+    const uint32_t size = _keys.size();
+    uint32_t slot = 1;
+    while(slot < size) {
+        /* the four slots two levels down share one cache line */
+        __builtin_prefetch(_keys.data() + 4 * slot);
+        slot = 2 * slot + less(slot, key, username);
+    }
+    /* Undo the right turns taken after the last left turn, that left turn
+     * was at the first username not ordered before the one searched for */
+    slot >>= __builtin_ffs(~slot);
+    if(slot == 0 || _names[_users[slot]] != username) return -1;
+    return _users[slot];
+}
+
+const Account* FrozenUTree::retrieveUser(std::string_view username, int disc) const {
+    int user = find(username);
+    if(user < 0) return nullptr;
+    const int16_t* base = _discs.data() + _first[user];
+    uint32_t count = _first[user + 1] - _first[user];
+    if(count == 0) return nullptr;
+    /* branchless lower bound, the compare turns into a conditional move */
+    while(count > 1) {
+        uint32_t half = count / 2;
+        base = (base[half] <= disc) ? base + half : base;
+        count -= half;
+    }
+    if(*base != disc) return nullptr;
+    return &_accounts[base - _discs.data()];
+}
+
+int FrozenUTree::numUsers(std::string_view username) const {
+    int user = find(username);
+    return user < 0 ? 0 : _first[user + 1] - _first[user];
+}
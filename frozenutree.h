@@ -0,0 +1,51 @@
+#pragma once
+
+#include "utree.h"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+/**
+ * Read-only copy of a UTree laid out for lookups, made by UTree::freeze.
+ *
+ * Usernames are kept in Eytzinger (breadth-first) order, so the first
+ * levels of every search share the same few cache lines and the children
+ * of a slot sit next to each other where they can be prefetched. Each slot
+ * holds the first 16 bytes of the username as two big-endian words, which
+ * compares the same way the strings do and keeps the search loop free of
+ * branches. Only usernames that share those 16 bytes fall back to a full
+ * string compare.
+ *
+ * Each username's discriminators are a contiguous sorted run of int16s,
+ * the Accounts are kept out of line in the same order.
+ */
+class FrozenUTree {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    FrozenUTree(const UTree& utree);
+
+    /* Account with this username and discriminator, nullptr if there is none */
+    const Account* retrieveUser(std::string_view username, int disc) const;
+    int numUsers(std::string_view username) const;
+    int numUsernames() const {return _names.size();}
+
+private:
+    struct Key {
+        uint64_t hi;
+        uint64_t lo;
+    };
+
+    std::vector<Key> _keys;             /* Eytzinger order, slot 0 unused */
+    std::vector<uint32_t> _users;       /* username index of each slot */
+    std::vector<string> _names;         /* usernames in order */
+    std::vector<uint32_t> _first;       /* first account of each username, plus the end */
+    std::vector<int16_t> _discs;
+    std::vector<Account> _accounts;
+
+    int find(std::string_view username) const;
+    bool less(uint32_t slot, const Key& key, std::string_view username) const;
+    static Key makeKey(std::string_view username);
+    void fillKeys(uint32_t slot, uint32_t& next);
+};
@@ -0,0 +1,283 @@
+#include "journal.h"
+#include "mappedfile.h"
+#include "snapshot.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#define RECORD_HEADER 8
+#define MAGIC_LENGTH 8
+#define CORRUPT_JOURNAL "Corrupt journal detected - the file does not start with the journal header"
+
+/**
+ * FNV-1a hash of a record payload.
+ */
+static uint32_t recordChecksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Reads the fields of one record payload in order.
+ */
+struct RecordReader {
+    const char* pos;
+    const char* end;
+    bool ok = true;
+
+    template <class T>
+    T read() {
+        T value = T();
+        if(end - pos < (long)sizeof(T)) {ok = false; return value;}
+        memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+    std::string_view readString() {
+        uint32_t length = read<uint32_t>();
+        if(!ok || uint32_t(end - pos) < length) {ok = false; return std::string_view();}
+        std::string_view str(pos, length);
+        pos += length;
+        return str;
+    }
+};
+
+/**
+ * Opens or creates the journal at path for appending. Anything a crash left
+ * after the last intact record is cut off first.
+ * @param path journal file
+ * @param groupSize most records covered by one fdatasync
+ * @param syncMillis longest a commit lets a written record go unsynced
+ */
+Journal::Journal(const string& path, int groupSize, int syncMillis):
+    _path(path), _groupSize(groupSize < 1 ? 1 : groupSize),
+    _syncDelay(syncMillis < 0 ? 0 : syncMillis), _numUnsynced(0) {
+    _fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+
+    /* Check to make sure the file was opened */
+    if(_fd < 0) {
+        std::cerr << __FUNCTION__ << ": File " << path << " could not be opened or created" << endl;
+        exit(-1);
+    }
+
+    size_t valid = 0;
+    size_t size = 0;
+    {
+        MappedFile file(path);
+        size = file.size();
+        if(size > 0) {
+            if(size < MAGIC_LENGTH || memcmp(file.begin(), JOURNAL_MAGIC, MAGIC_LENGTH) != 0) {
+                close(_fd);
+                throw std::invalid_argument(CORRUPT_JOURNAL);
+            }
+            valid = validLength(file.begin(), size);
+        }
+    }
+    if(size == 0) {
+        _pending.assign(JOURNAL_MAGIC, MAGIC_LENGTH);
+        writePending();
+        _pending.clear();
+        fsync(_fd);
+    } else if(valid < size) {
+        if(ftruncate(_fd, valid) != 0) throw std::runtime_error("Journal could not drop its torn tail");
+        fsync(_fd);
+    }
+    lseek(_fd, 0, SEEK_END);
+}
+
+/**
+ * Syncs whatever was written since the last fdatasync.
+ */
+Journal::~Journal() {
+    try {
+        sync();
+    } catch(const std::exception& e) {
+        std::cerr << __FUNCTION__ << ": " << e.what() << endl;
+    }
+    close(_fd);
+}
+
+void Journal::logInsert(const Account& acct) {
+    beginRecord(JOURNAL_INSERT, acct.getDiscriminator(), acct.hasNitro());
+    appendString(acct.getUsername());
+    appendString(acct.getBadge());
+    appendString(acct.getStatus());
+    endRecord();
+}
+
+void Journal::logRemove(std::string_view username, int disc) {
+    beginRecord(JOURNAL_REMOVE, disc, false);
+    appendString(username);
+    endRecord();
+}
+
+/**
+ * Writes the record just logged if the operation changed the tree, and
+ * syncs once the group is full or its oldest record has waited too long.
+ * @param applied true if the operation went through, false if it was rejected
+ */
+void Journal::commit(bool applied) {
+    auto now = std::chrono::steady_clock::now();
+    if(applied && !_pending.empty()) {
+        writePending();
+        if(_numUnsynced++ == 0) _firstUnsynced = now;
+    }
+    _pending.clear();
+    if(_numUnsynced >= _groupSize || (_numUnsynced > 0 && now - _firstUnsynced >= _syncDelay)) sync();
+}
+
+void Journal::sync() {
+    if(_numUnsynced == 0) return;
+    if(fdatasync(_fd) != 0) throw std::runtime_error("Journal could not be synced");
+    _numUnsynced = 0;
+}
+
+/**
+ * Writes a snapshot of utree to basePath and then empties the journal. A
+ * crash in between only means the journal is replayed onto a base that
+ * already has it, and replaying is idempotent: rejected operations are
+ * never logged, so each account's records alternate insert/remove and end
+ * in the state the snapshot holds.
+ * @return true if the journal was compacted, false if the snapshot failed
+ */
+bool Journal::compact(const UTree& utree, const string& basePath) {
+    sync();
+    if(!utree.saveSnapshot(basePath)) return false;
+    if(ftruncate(_fd, MAGIC_LENGTH) != 0 || fsync(_fd) != 0) return false;
+    lseek(_fd, 0, SEEK_END);
+    return true;
+}
+
+/**
+ * Puts a tree's journal back when replay returns or throws.
+ */
+struct ReattachJournal {
+    UTree& utree;
+    Journal* attached;
+    ~ReattachJournal() {utree.setJournal(attached);}
+};
+
+/**
+ * Applies every intact record of the journal at path to utree. A missing
+ * journal is treated as empty. If a record can't be applied the exception
+ * is passed on, with utree's journal still attached.
+ * @return number of records applied
+ */
+int Journal::replay(const string& path, UTree& utree) {
+    MappedFile file(path);
+    if(!file.isOpen() || file.size() == 0) return 0;
+    if(file.size() < MAGIC_LENGTH || memcmp(file.begin(), JOURNAL_MAGIC, MAGIC_LENGTH) != 0) {
+        throw std::invalid_argument(CORRUPT_JOURNAL);
+    }
+
+    /* Replayed operations must not be logged again */
+    ReattachJournal reattach = {utree, utree.getJournal()};
+    utree.setJournal(nullptr);
+
+    int applied = 0;
+    size_t valid = validLength(file.begin(), file.size());
+    const char* pos = file.begin() + MAGIC_LENGTH;
+    while(pos < file.begin() + valid) {
+        uint32_t length;
+        memcpy(&length, pos, sizeof(length));
+        RecordReader record = {pos + RECORD_HEADER, pos + RECORD_HEADER + length};
+        pos += RECORD_HEADER + length;
+
+        uint8_t type = record.read<uint8_t>();
+        int16_t disc = record.read<int16_t>();
+        uint8_t nitro = record.read<uint8_t>();
+        std::string_view username = record.readString();
+        if(type == JOURNAL_INSERT) {
+            std::string_view badge = record.readString();
+            std::string_view status = record.readString();
+            if(!record.ok) break;
+            utree.insert(Account(string(username), disc, nitro, string(badge), string(status)));
+        } else if(type == JOURNAL_REMOVE && record.ok) {
+            DNode* removed;
+            utree.removeUser(username, disc, removed);
+        } else {
+            break;
+        }
+        applied++;
+    }
+    return applied;
+}
+
+/**
+ * Rebuilds a tree after a restart: loads the base file, a snapshot or a
+ * .csv export, and replays the journal on top of it.
+ * @return number of journal records applied
+ */
+int Journal::recover(UTree& utree, const string& basePath, const string& journalPath) {
+    bool isSnapshot;
+    bool exists;
+    {
+        MappedFile base(basePath);
+        exists = base.isOpen();
+        isSnapshot = base.size() >= MAGIC_LENGTH && memcmp(base.begin(), SNAPSHOT_MAGIC, MAGIC_LENGTH) == 0;
+    }
+    if(!exists) {
+        utree.clear();
+    } else if(isSnapshot) {
+        utree.loadSnapshot(basePath);
+    } else {
+        utree.loadMapped(basePath, false);
+    }
+    return replay(journalPath, utree);
+}
+
+void Journal::beginRecord(int type, int disc, bool nitro) {
+    _pending.assign(RECORD_HEADER, '\0');
+    uint8_t recordType = type;
+    int16_t recordDisc = disc;
+    uint8_t recordNitro = nitro;
+    _pending.append(reinterpret_cast<const char*>(&recordType), sizeof(recordType));
+    _pending.append(reinterpret_cast<const char*>(&recordDisc), sizeof(recordDisc));
+    _pending.append(reinterpret_cast<const char*>(&recordNitro), sizeof(recordNitro));
+}
+
+void Journal::appendString(std::string_view str) {
+    uint32_t length = str.size();
+    _pending.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    _pending.append(str);
+}
+
+void Journal::endRecord() {
+    uint32_t length = _pending.size() - RECORD_HEADER;
+    uint32_t checksum = recordChecksum(&_pending[RECORD_HEADER], length);
+    memcpy(&_pending[0], &length, sizeof(length));
+    memcpy(&_pending[sizeof(length)], &checksum, sizeof(checksum));
+}
+
+void Journal::writePending() {
+    const char* data = _pending.data();
+    size_t left = _pending.size();
+    while(left > 0) {
+        ssize_t written = ::write(_fd, data, left);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            throw std::runtime_error("Journal write failed");
+        }
+        data += written;
+        left -= written;
+    }
+}
+
+/**
+ * Length of the header plus every intact record at the start of data.
+ */
+size_t Journal::validLength(const char* data, size_t size) {
+    size_t pos = MAGIC_LENGTH;
+    while(size - pos >= RECORD_HEADER) {
+        uint32_t length, checksum;
+        memcpy(&length, data + pos, sizeof(length));
+        memcpy(&checksum, data + pos + sizeof(length), sizeof(checksum));
+        if(length > size - pos - RECORD_HEADER) break;
+        if(recordChecksum(data + pos + RECORD_HEADER, length) != checksum) break;
+        pos += RECORD_HEADER + length;
+    }
+    return pos;
+}
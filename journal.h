@@ -0,0 +1,83 @@
+#pragma once
+
+#include "utree.h"
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+#define JOURNAL_MAGIC "DTJRNL01"
+#define JOURNAL_GROUP_SIZE 64       /* records per group commit */
+#define JOURNAL_SYNC_MS 10          /* longest a written record waits for its fdatasync */
+
+/* Journal record types */
+#define JOURNAL_INSERT 1
+#define JOURNAL_REMOVE 2
+
+/*
+ * Journal layout: the 8 byte magic, then one record per applied operation
+ *   uint32_t length                    bytes of payload
+ *   uint32_t checksum                  of the payload
+ *   payload                            type, disc, nitro, then each string
+ *                                      as a uint32_t length and its bytes
+ * A record that is cut short or fails its checksum ends the journal, which
+ * is what a crash in the middle of a write leaves behind.
+ */
+
+/**
+ * Append-only log of UTree::insert and UTree::removeUser. Each record is
+ * written to the file as its operation commits, so a crash of the process
+ * loses nothing that was applied. Only the fdatasync is shared: one per
+ * group of groupSize records, or by the first commit more than syncMillis
+ * after the oldest unsynced record, or whenever sync() is called. A power
+ * loss can therefore lose up to groupSize - 1 records written within
+ * syncMillis, plus anything written since the last commit when no later
+ * commit comes along. A service that goes idle should call sync() from a
+ * timer to close that gap. Attach it with UTree::setJournal. Bulk loads and
+ * snapshot restores are not logged, compact() after them.
+ */
+class Journal {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    Journal(const string& path, int groupSize = JOURNAL_GROUP_SIZE, int syncMillis = JOURNAL_SYNC_MS);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /* Called by UTree before it applies an operation */
+    void logInsert(const Account& acct);
+    void logRemove(std::string_view username, int disc);
+    /* Called by UTree after the operation, writes the record if it was
+     * applied and drops it if it was rejected */
+    void commit(bool applied);
+
+    /* Waits for every written record to reach the disk */
+    void sync();
+
+    /* Folds the journal into a fresh snapshot at basePath and empties it */
+    bool compact(const UTree& utree, const string& basePath);
+
+    /* Applies every intact record of a journal file to utree */
+    static int replay(const string& path, UTree& utree);
+
+    /* Loads basePath (a snapshot or a .csv file) then replays the journal */
+    static int recover(UTree& utree, const string& basePath, const string& journalPath);
+
+private:
+    string _path;
+    int _fd;
+    int _groupSize;
+    std::chrono::milliseconds _syncDelay;
+    string _pending;        /* record logged but not committed yet */
+    int _numUnsynced;       /* records written since the last fdatasync */
+    std::chrono::steady_clock::time_point _firstUnsynced;
+
+    void beginRecord(int type, int disc, bool nitro);
+    void endRecord();
+    void appendString(std::string_view str);
+    void writePending();
+
+    static size_t validLength(const char* data, size_t size);
+};
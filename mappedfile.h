@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * Read-only mapping of a whole file, unmapped when it goes out of scope.
+ * sequential tells the kernel to read ahead, leave it off for random access.
+ */
+class MappedFile {
+public:
+    MappedFile(const std::string& path, bool sequential = true): _data(nullptr), _size(0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) return;
+        struct stat info;
+        if(fstat(fd, &info) == 0) {
+            _size = info.st_size;
+            _opened = true;
+            if(_size > 0) {
+                void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(data == MAP_FAILED) {
+                    _opened = false;
+                } else {
+                    _data = static_cast<const char*>(data);
+                    madvise(data, _size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                }
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if(_data != nullptr) munmap(const_cast<char*>(_data), _size);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const {return _opened;}
+    const char* begin() const {return _data;}
+    const char* end() const {return _data + _size;}
+    size_t size() const {return _size;}
+
+private:
+    const char* _data;
+    size_t _size;
+    bool _opened = false;
+};
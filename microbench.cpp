@@ -0,0 +1,282 @@
+#include "utree.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+/*
+ * Microbenchmarks of the DTree and UTree operations, written as JSON so
+ * runs can be compared between releases. Every workload is drawn from the
+ * same seeded generator as driver.cpp, so two runs time the same operations.
+ *
+ *   microbench [output.json]      writes to stdout without a path
+ */
+
+#define DTREE_SIZE 4000             /* users per DTree, below DENSE_ENTER */
+#define NUMDTREES 50
+#define NUMUTREEACCTS 200000
+#define NUMUTREENAMES 20000
+#define ZIPF_EXPONENT 1.0
+#define NUMLOADS 5
+#define NUMREBALANCES 2000
+#define BENCH_CSV "microbench_accounts.csv"
+
+std::mt19937 rng(10);
+std::uniform_int_distribution<> distAcct(MIN_DISC, MAX_DISC);
+
+using Clock = std::chrono::steady_clock;
+
+/* Every allocation made through operator new, for allocations per op */
+static std::atomic<long long> numAllocations{0};
+
+void* operator new(size_t size) {
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size == 0 ? 1 : size);
+    if(ptr == nullptr) throw std::bad_alloc();
+    return ptr;
+}
+void* operator new[](size_t size) {return operator new(size);}
+void operator delete(void* ptr) noexcept {std::free(ptr);}
+void operator delete[](void* ptr) noexcept {std::free(ptr);}
+void operator delete(void* ptr, size_t) noexcept {std::free(ptr);}
+void operator delete[](void* ptr, size_t) noexcept {std::free(ptr);}
+
+/**
+ * Latency of every op of one benchmark, and the allocations made by all of
+ * them. Samples are reserved up front so recording allocates nothing.
+**/
+class Recorder {
+public:
+    Recorder(const char* name, const char* workload, size_t ops): _name(name), _workload(workload) {
+        _samples.reserve(ops);
+        _allocations = numAllocations.load();
+    }
+
+    /* Times one op */
+    template <class Op>
+    void time(Op op) {
+        auto begin = Clock::now();
+        op();
+        _samples.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count());
+    }
+
+    /* Stops the clocks and appends the result to results, extra is more
+     * "key": value pairs to add to it */
+    void finish(std::vector<string>& results, const string& extra = "") {
+        long long allocations = numAllocations.load() - _allocations;
+        if(_samples.empty()) return;
+        double total = 0;
+        for(long long ns : _samples) total += ns;
+        std::sort(_samples.begin(), _samples.end());
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "{\"name\": \"%s\", \"workload\": \"%s\", \"ops\": %zu, \"ns_per_op\": %.1f, "
+                 "\"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"max\": %lld, \"allocs_per_op\": %.3f",
+                 _name, _workload, _samples.size(), total / _samples.size(), percentile(50), percentile(90),
+                 percentile(99), _samples.back(), double(allocations) / _samples.size());
+        results.push_back(line + (extra.empty() ? "" : ", " + extra) + "}");
+    }
+
+private:
+    const char* _name;
+    const char* _workload;
+    std::vector<long long> _samples;
+    long long _allocations;
+
+    long long percentile(int p) const {return _samples[std::min(_samples.size() - 1, _samples.size() * p / 100)];}
+};
+
+/**
+ * Discriminators of one DTree in the order a workload inserts them.
+**/
+std::vector<int> makeDiscs(bool sequential) {
+    std::vector<int> discs;
+    if(sequential) {
+        for(int disc = MIN_DISC; disc < MIN_DISC + DTREE_SIZE; disc++) discs.push_back(disc);
+    } else {
+        std::vector<bool> used(MAX_DISC - MIN_DISC + 1);
+        while(int(discs.size()) < DTREE_SIZE) {
+            int disc = distAcct(rng);
+            if(!used[disc - MIN_DISC]) {
+                used[disc - MIN_DISC] = true;
+                discs.push_back(disc);
+            }
+        }
+    }
+    return discs;
+}
+
+/**
+ * insert, retrieve and remove on NUMDTREES standalone DTrees.
+**/
+void benchDTree(const char* workload, bool sequential, std::vector<string>& results) {
+    std::vector<std::vector<int>> discs;
+    for(int t = 0; t < NUMDTREES; t++) discs.push_back(makeDiscs(sequential));
+    std::vector<DTree> dtrees(NUMDTREES);
+    std::vector<Account> accts;
+    accts.reserve(DTREE_SIZE);
+
+    Recorder insert("DTree::insert", workload, NUMDTREES * DTREE_SIZE);
+    for(int t = 0; t < NUMDTREES; t++) {
+        accts.clear();
+        for(int disc : discs[t]) accts.push_back(Account("bench", disc, 0, "", ""));
+        for(Account& acct : accts) insert.time([&]() {dtrees[t].insert(std::move(acct));});
+    }
+    insert.finish(results);
+
+    Recorder retrieve("DTree::retrieve", workload, NUMDTREES * DTREE_SIZE);
+    for(int t = 0; t < NUMDTREES; t++) {
+        std::shuffle(discs[t].begin(), discs[t].end(), rng);
+        for(int disc : discs[t]) retrieve.time([&]() {dtrees[t].retrieve(disc);});
+    }
+    retrieve.finish(results);
+
+    Recorder remove("DTree::remove", workload, NUMDTREES * DTREE_SIZE);
+    DNode* removed;
+    for(int t = 0; t < NUMDTREES; t++) {
+        for(int disc : discs[t]) remove.time([&]() {dtrees[t].remove(disc, removed);});
+    }
+    remove.finish(results);
+}
+
+/**
+ * Whole tree rebalances, timed through compact on a tree with one vacant
+ * node so every call rebuilds all DTREE_SIZE nodes.
+**/
+void benchRebalance(std::vector<string>& results) {
+    DTree dtree;
+    dtree.setCompaction(CompactPolicy(0, 0));
+    for(int disc : makeDiscs(false)) dtree.insert(Account("bench", disc, 0, "", ""));
+    DNode* removed;
+    Recorder rebalance("DTree::rebalance", "uniform", NUMREBALANCES);
+    for(int i = 0; i < NUMREBALANCES; i++) {
+        Account acct = dtree.select(i % dtree.getNumUsers())->getAccount();
+        dtree.remove(acct.getDiscriminator(), removed);
+        rebalance.time([&]() {dtree.compact();});
+        dtree.insert(acct);
+    }
+    rebalance.finish(results);
+}
+
+/**
+ * DTree inserts under each balance policy, with the rebuilds they cause and
+ * the depth of the tree they leave, so rebuild work can be weighed against
+ * lookup cost.
+**/
+void benchBalancePolicies(const char* workload, bool sequential, std::vector<string>& results) {
+    struct Policy {const char* name; int policy; int num; int den;};
+    const Policy policies[] = {{"DTree::balance[discord 3/2]", BALANCE_DISCORD, 3, 2},
+                               {"DTree::balance[discord 2/1]", BALANCE_DISCORD, 2, 1},
+                               {"DTree::balance[weight 3/4]", BALANCE_WEIGHT, 3, 4},
+                               {"DTree::balance[scapegoat 2/3]", BALANCE_SCAPEGOAT, 2, 3}};
+    std::vector<int> discs = makeDiscs(sequential);
+    for(const Policy& policy : policies) {
+        DTree dtree;
+        dtree.setBalance(BalancePolicy(policy.policy, BALANCE_MIN_SIZE, policy.num, policy.den));
+        std::vector<Account> accts;
+        for(int disc : discs) accts.push_back(Account("bench", disc, 0, "", ""));
+        Stats before = Stats::snapshot();
+        Recorder insert(policy.name, workload, accts.size());
+        for(Account& acct : accts) insert.time([&]() {dtree.insert(std::move(acct));});
+        Stats after = Stats::snapshot();
+        char extra[160];
+        snprintf(extra, sizeof(extra), "\"rebuilds_per_op\": %.4f, \"rebuilt_nodes_per_op\": %.3f, \"average_depth\": %.3f",
+                 double(after.rebuilds - before.rebuilds) / discs.size(),
+                 double(after.rebuildSizes.sum - before.rebuildSizes.sum) / discs.size(), dtree.averageDepth());
+        insert.finish(results, extra);
+    }
+}
+
+/**
+ * NUMUTREEACCTS accounts over NUMUTREENAMES usernames, picked uniformly or
+ * with Zipfian popularity, where username k is drawn in proportion to
+ * 1 / k^ZIPF_EXPONENT.
+**/
+std::vector<Account> makeAccounts(bool zipf) {
+    std::vector<double> weights;
+    for(int k = 1; k <= NUMUTREENAMES; k++) weights.push_back(zipf ? 1.0 / std::pow(k, ZIPF_EXPONENT) : 1.0);
+    std::discrete_distribution<> distName(weights.begin(), weights.end());
+    std::vector<Account> accts;
+    accts.reserve(NUMUTREEACCTS);
+    for(int i = 0; i < NUMUTREEACCTS; i++) {
+        accts.push_back(Account("user" + std::to_string(distName(rng)), distAcct(rng), i % 2, "", ""));
+    }
+    return accts;
+}
+
+/**
+ * insert, retrieve, retrieveUser and removeUser on one UTree.
+**/
+void benchUTree(const char* workload, bool zipf, std::vector<string>& results) {
+    std::vector<Account> accts = makeAccounts(zipf);
+    std::vector<Account> copies = accts;
+    UTree utree;
+
+    Recorder insert("UTree::insert", workload, accts.size());
+    for(Account& acct : copies) insert.time([&]() {utree.insert(std::move(acct));});
+    insert.finish(results);
+
+    std::shuffle(accts.begin(), accts.end(), rng);
+    Recorder retrieve("UTree::retrieve", workload, accts.size());
+    for(const Account& acct : accts) retrieve.time([&]() {utree.retrieve(acct.getUsername());});
+    retrieve.finish(results);
+
+    Recorder retrieveUser("UTree::retrieveUser", workload, accts.size());
+    for(const Account& acct : accts) retrieveUser.time([&]() {utree.retrieveUser(acct.getUsername(), acct.getDiscriminator());});
+    retrieveUser.finish(results);
+
+    Recorder removeUser("UTree::removeUser", workload, accts.size());
+    DNode* removed;
+    for(const Account& acct : accts) removeUser.time([&]() {utree.removeUser(acct.getUsername(), acct.getDiscriminator(), removed);});
+    removeUser.finish(results);
+}
+
+/**
+ * loadData of a CSV file of NUMUTREEACCTS accounts into an empty tree, one
+ * op per load.
+**/
+void benchLoadData(std::vector<string>& results) {
+    FILE* out = fopen(BENCH_CSV, "w");
+    for(const Account& acct : makeAccounts(false)) {
+        fprintf(out, "%s,%d,%d,%s,%s\n", acct.getUsername().c_str(), acct.getDiscriminator(), int(acct.hasNitro()),
+                acct.getBadge().c_str(), acct.getStatus().c_str());
+    }
+    fclose(out);
+    Recorder load("UTree::loadData", "uniform", NUMLOADS);
+    for(int i = 0; i < NUMLOADS; i++) {
+        UTree utree;
+        load.time([&]() {utree.loadData(BENCH_CSV);});
+    }
+    load.finish(results);
+    std::remove(BENCH_CSV);
+}
+
+int main(int argc, char** argv) {
+    std::vector<string> results;
+    benchDTree("uniform", false, results);
+    benchDTree("sequential", true, results);
+    benchRebalance(results);
+    benchBalancePolicies("uniform", false, results);
+    benchBalancePolicies("sequential", true, results);
+    benchUTree("uniform", false, results);
+    benchUTree("zipf", true, results);
+    benchLoadData(results);
+
+    FILE* out = (argc > 1 ? fopen(argv[1], "w") : stdout);
+    if(out == nullptr) {
+        std::cerr << __FUNCTION__ << ": File " << argv[1] << " could not be opened or created" << endl;
+        return 1;
+    }
+    fprintf(out, "{\"seed\": 10, \"results\": [\n");
+    for(size_t i = 0; i < results.size(); i++) {
+        fprintf(out, "  %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    if(out != stdout) fclose(out);
+    return 0;
+}
@@ -1,5 +1,21 @@
 #include "utree.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "concurrentutree.h"
+#include "shardedutree.h"
+#include "frozenutree.h"
+#include "prefixindex.h"
+#include "exportsink.h"
+#include "trace.h"
+#include "stats.h"
 #include <random>
+#include <thread>
+#include <atomic>
+#include <array>
+#include <climits>
+#include <set>
+#include <map>
+#include <algorithm>
 
 #define NUMACCTS 20
 #define RANDDISC (distAcct(rng))
@@ -11,6 +27,34 @@ class Tester {
 public:
   bool testBasicDTreeInsert(DTree& dtree);
   bool testBasicUTreeInsert(UTree& utree);
+  bool testDTreeSizes(DTree& dtree);
+  bool testMappedLoad();
+  bool testParallelLoad();
+  bool testBuildFromSorted();
+  bool testSnapshot(UTree& utree);
+  bool testJournal();
+  bool testJournalFailedReplay();
+  bool testConcurrentReads();
+  bool testConcurrentFailedWrite();
+  bool testShardedUTree();
+  bool testOrderStatistics();
+  bool testAllocateDiscriminator();
+  bool testDenseMode();
+  bool testCompaction();
+  bool testSmallMode();
+  bool testRemoveUsers();
+  bool testApplyBatch();
+  bool testFreeze();
+  bool testPrefixScan();
+  bool testIterators();
+  bool testExport();
+  bool testTrace();
+  bool testStats();
+  bool testBalancePolicies();
+  int checkAVL(UNode* node, const string* low, const string* high);
+  bool sameUsers(const DTree& dtree, const std::set<int>& live);
+  string capture(UTree& utree);
+  int checkSizes(DNode* node);
   
 };
 
@@ -45,6 +89,900 @@ bool Tester::testBasicUTreeInsert(UTree& utree) {
     return true;
 }
 
+//Dumps and prints a UTree into a string so two trees can be compared.
+string Tester::capture(UTree& utree) {
+    std::stringstream out;
+    std::streambuf* old = cout.rdbuf(out.rdbuf());
+    utree.dump();
+    utree.printUsers();
+    cout.rdbuf(old);
+    return out.str();
+}
+
+//The mapped loader should build exactly the same tree as loadData.
+bool Tester::testMappedLoad() {
+    UTree streamed, mapped;
+    streamed.loadData("accounts.csv");
+    mapped.loadMapped("accounts.csv");
+    return capture(streamed) == capture(mapped);
+}
+
+//The parallel loader stores the same accounts as loadData, the UTree shape
+//may differ since usernames arrive in sorted order.
+bool Tester::testParallelLoad() {
+    UTree streamed, parallel;
+    streamed.loadData("accounts.csv");
+    parallel.loadParallel("accounts.csv", true, 4);
+    std::stringstream a, b;
+    std::streambuf* old = cout.rdbuf(a.rdbuf());
+    streamed.printUsers();
+    cout.rdbuf(b.rdbuf());
+    parallel.printUsers();
+    cout.rdbuf(old);
+    return a.str() == b.str();
+}
+
+//Bulk building from sorted accounts gives balanced trees with correct sizes.
+bool Tester::testBuildFromSorted() {
+    std::vector<Account> sorted;
+    for(int name = 0; name < 50; name++) {
+        for(int disc = 0; disc < 100; disc += 1 + name % 3) {
+            sorted.push_back(Account("user" + std::to_string(100 + name), disc, 0, "", ""));
+        }
+    }
+    sorted.push_back(sorted.back()); //repeated accounts keep the first
+    UTree utree;
+    utree.buildFromSorted(sorted);
+    for(const Account& acct : sorted) {
+        if(utree.retrieveUser(acct.getUsername(), acct.getDiscriminator()) == nullptr) return false;
+    }
+    if(utree._root->_height != 5 || utree.numUsers("user100") != 100 || utree.numUsers("user149") != 50) return false;
+
+    DTree dtree;
+    std::vector<Account> discs;
+    for(int disc = 0; disc < 1023; disc++) discs.push_back(Account("", disc, 0, "", ""));
+    dtree.buildFromSorted(discs);
+    DNode* node = dtree._root;
+    int depth = 0;
+    while(node != nullptr) {node = node->_left; depth++;}
+    return checkSizes(dtree._root) == 1023 && depth == 10;
+}
+
+//Restoring a snapshot gives back the same shapes, and the mapped view
+//answers lookups straight from the file.
+bool Tester::testSnapshot(UTree& utree) {
+    if(!utree.saveSnapshot("mytest.snap")) return false;
+    UTree restored;
+    restored.loadSnapshot("mytest.snap");
+    SnapshotView view("mytest.snap");
+    Account found;
+    bool passed = capture(utree) == capture(restored)
+        && view.numUsers("Capstan") == utree.numUsers("Capstan")
+        && view.retrieveUser("Capstan", 4962, found) && found.getStatus() == "proj2 :100:"
+        && !view.retrieveUser("Capstan", 4963, found);
+    std::remove("mytest.snap");
+    return passed;
+}
+
+//Changes logged after a compaction are recovered on top of the snapshot,
+//even before the group is synced, and a torn record at the end of the
+//journal is ignored.
+bool Tester::testJournal() {
+    std::remove("mytest.log");
+    UTree utree;
+    utree.loadData("accounts.csv");
+    {
+        Journal journal("mytest.log", 4);
+        utree.setJournal(&journal);
+        journal.compact(utree, "mytest.snap");
+        DNode* removed;
+        utree.insert(Account("Journaled", 1, 0, "", ""));
+        utree.insert(Account("Capstan", 1, 1, "Subscriber", "logged"));
+        utree.removeUser("Capstan", 604, removed);
+        //a crash now must not lose them, though the group of 4 isn't full
+        UTree crashed;
+        if(Journal::recover(crashed, "mytest.snap", "mytest.log") != 3 || capture(crashed) != capture(utree)) return false;
+        utree.setJournal(nullptr);
+    }
+    std::ofstream torn("mytest.log", std::ios::app | std::ios::binary);
+    torn << "torn";
+    torn.close();
+
+    UTree recovered;
+    int replayed = Journal::recover(recovered, "mytest.snap", "mytest.log");
+    std::remove("mytest.log");
+    std::remove("mytest.snap");
+    return replayed == 3 && capture(utree) == capture(recovered);
+}
+
+//A record that can't be applied stops a replay with its exception, and the
+//tree keeps its journal and the records applied before it.
+bool Tester::testJournalFailedReplay() {
+    std::remove("mytest.log");
+    {
+        Journal journal("mytest.log");
+        journal.logInsert(Account("Replayed", 1, 0, "", ""));
+        journal.commit(true);
+        //a discriminator no Account takes, behind a valid checksum
+        journal.beginRecord(JOURNAL_INSERT, MAX_DISC + 1, false);
+        journal.appendString("Replayed");
+        journal.appendString("");
+        journal.appendString("");
+        journal.endRecord();
+        journal.commit(true);
+    }
+    UTree utree;
+    Journal attached("mytest2.log");
+    utree.setJournal(&attached);
+    bool threw = false;
+    try {
+        Journal::replay("mytest.log", utree);
+    } catch(const std::out_of_range&) {
+        threw = true;
+    }
+    bool passed = threw && utree.getJournal() == &attached && utree.numUsers("Replayed") == 1;
+    utree.setJournal(nullptr);
+    std::remove("mytest.log");
+    std::remove("mytest2.log");
+    return passed;
+}
+
+//Readers running next to a writer always see accounts the writer doesn't
+//touch, and both copies of the tree end up identical.
+bool Tester::testConcurrentReads() {
+    ConcurrentUTree ctree;
+    ctree.loadMapped("accounts.csv");
+    Account stable = ctree._trees[0]._root->_dtree->select(0)->getAccount();
+    int stableUsers = ctree.numUsers(stable.getUsername());
+
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+    for(int i = 0; i < 4; i++) {
+        readers.emplace_back([&]() {
+            Account found;
+            while(!done.load()) {
+                if(!ctree.retrieveUser(stable.getUsername(), stable.getDiscriminator(), found)
+                   || found.getBadge() != stable.getBadge()
+                   || ctree.numUsers(stable.getUsername()) != stableUsers) {
+                    errors++;
+                }
+                ctree.numUsers("Concurrent");
+            }
+        });
+    }
+    ctree.insert(Account("Concurrent", 9999, 0, "", ""));
+    for(int disc = 1; disc <= 50; disc++) ctree.insert(Account("Concurrent", disc, 0, "", ""));
+    for(int disc = 1; disc <= 50; disc += 2) ctree.removeUser("Concurrent", disc);
+    done = true;
+    for(std::thread& reader : readers) reader.join();
+
+    return errors == 0 && ctree.numUsers("Concurrent") == 26
+        && capture(ctree._trees[0]) == capture(ctree._trees[1]);
+}
+
+//A load that throws partway leaves both copies holding the same accounts,
+//so readers see the same data whichever copy is published.
+bool Tester::testConcurrentFailedWrite() {
+    ConcurrentUTree ctree;
+    ctree.loadMapped("accounts.csv");
+    std::ofstream("mytest_malformed.csv") << "Partial,1,0,,\nPartial,2,0,,\nno fields here\nPartial,3,0,,\n";
+    bool threw = false;
+    try {
+        ctree.loadMapped("mytest_malformed.csv");
+    } catch(const std::invalid_argument&) {
+        threw = true;
+    }
+    std::remove("mytest_malformed.csv");
+    int partial = ctree.numUsers("Partial");
+    ctree.insert(Account("AfterFailure", 1, 0, "", ""));
+
+    auto accounts = [this](UTree& utree) {
+        std::stringstream out;
+        std::streambuf* old = cout.rdbuf(out.rdbuf());
+        utree.printUsers();
+        cout.rdbuf(old);
+        return out.str();
+    };
+    string published = accounts(ctree._trees[ctree._published.load()]);
+    return threw && accounts(ctree._trees[0]) == accounts(ctree._trees[1]) && published.find("Partial") == string::npos
+        && partial == 0 && ctree.numUsers("AfterFailure") == 1;
+}
+
+//A sharded tree prints the same accounts in the same order as one UTree,
+//including after writers on several threads.
+bool Tester::testShardedUTree() {
+    UTree utree;
+    ShardedUTree sharded(4);
+    utree.loadData("accounts.csv");
+    sharded.loadData("accounts.csv");
+    sharded.loadData("accounts.csv");   //into full shards, every account repeats
+
+    std::vector<std::thread> writers;
+    for(int t = 0; t < 4; t++) {
+        writers.emplace_back([&sharded, t]() {
+            string username = "Sharded" + std::to_string(t);
+            for(int disc = 1; disc <= 100; disc++) sharded.insert(Account(username, disc, 0, "", ""));
+        });
+    }
+    for(std::thread& writer : writers) writer.join();
+    for(int t = 0; t < 4; t++) {
+        for(int disc = 1; disc <= 100; disc++) utree.insert(Account("Sharded" + std::to_string(t), disc, 0, "", ""));
+    }
+
+    std::stringstream expected, merged;
+    std::streambuf* old = cout.rdbuf(expected.rdbuf());
+    utree.printUsers();
+    cout.rdbuf(merged.rdbuf());
+    sharded.printUsers();
+    cout.rdbuf(old);
+
+    Account found;
+    return expected.str() == merged.str() && sharded.numUsers("Sharded2") == 100
+        && sharded.retrieveUser("Sharded3", 42, found) && !sharded.retrieveUser("Sharded3", 101, found);
+}
+
+//rank, select and countInRange agree with counting the live discriminators
+//one by one, with vacant nodes scattered through the tree.
+bool Tester::testOrderStatistics() {
+    DTree dtree;
+    std::set<int> live;
+    DNode* removed;
+    for(int i = 0; i < 2000; i++) {
+        int disc = RANDDISC;
+        if(dtree.insert(Account("", disc, 0, "", ""))) live.insert(disc);
+        auto victim = live.lower_bound(RANDDISC);
+        if(i % 3 == 0 && victim != live.end() && dtree.remove(*victim, removed)) {
+            live.erase(victim);
+        }
+    }
+
+    std::vector<int> sorted(live.begin(), live.end());
+    for(int k = 0; k < int(sorted.size()); k++) {
+        DNode* found = dtree.select(k);
+        if(found == nullptr || found->getDiscriminator() != sorted[k]) return false;
+        if(dtree.rank(sorted[k]) != k) return false;
+    }
+    if(dtree.select(sorted.size()) != nullptr || dtree.select(-1) != nullptr) return false;
+    for(int i = 0; i < 200; i++) {
+        int lo = RANDDISC, hi = RANDDISC;
+        int expected = 0;
+        for(int disc : sorted) expected += (disc >= lo && disc <= hi);
+        if(dtree.countInRange(lo, hi) != expected) return false;
+    }
+    int total = sorted.size();
+    return dtree.countInRange(0, INT_MAX) == total && dtree.countInRange(INT_MIN, INT_MAX) == total
+        && dtree.countInRange(INT_MAX, INT_MAX) == 0 && dtree.countInRange(INT_MIN, -1) == 0;
+}
+
+//Allocated discriminators are always free, and a username holding every
+//discriminator is reported as saturated.
+bool Tester::testAllocateDiscriminator() {
+    UTree utree;
+    DNode* removed;
+    if(utree.allocateDiscriminator("Signup") != MIN_DISC) return false;
+    for(int disc = MIN_DISC; disc <= MAX_DISC; disc++) {
+        if(disc != 5000 && disc != 7) utree.insert(Account("Signup", disc, 0, "", ""));
+    }
+    if(utree.allocateDiscriminator("Signup") != 7) return false;
+    int random = utree.allocateDiscriminator("Signup", DISC_RANDOM);
+    if(random != 7 && random != 5000) return false;
+
+    utree.insert(Account("Signup", 7, 0, "", ""));
+    utree.insert(Account("Signup", 5000, 0, "", ""));
+    if(utree.allocateDiscriminator("Signup", DISC_RANDOM) != INVALID_DISC) return false;
+
+    utree.removeUser("Signup", 9001, removed);
+    utree.removeUser("Signup", 1234, removed);
+    if(utree.allocateDiscriminator("Signup", DISC_REUSE) != 1234) return false;
+    if(utree.allocateDiscriminator("Signup") != 1234) return false;
+
+    //random picks only ever land on the two free discriminators
+    for(int i = 0; i < 1000; i++) {
+        int disc = utree.allocateDiscriminator("Signup", DISC_RANDOM);
+        if(disc != 1234 && disc != 9001) return false;
+    }
+    return true;
+}
+
+//Checks every query of dtree against the set of discriminators it should hold.
+bool Tester::sameUsers(const DTree& dtree, const std::set<int>& live) {
+    if(dtree.getNumUsers() != int(live.size())) return false;
+    std::vector<int> sorted(live.begin(), live.end());
+    for(int k = 0; k < int(sorted.size()); k += 7) {
+        DNode* found = dtree.select(k);
+        if(found == nullptr || found->getDiscriminator() != sorted[k] || dtree.rank(sorted[k]) != k) return false;
+    }
+    for(int i = 0; i < 300; i++) {
+        int disc = RANDDISC;
+        if((dtree.retrieve(disc) != nullptr) != (live.count(disc) == 1)) return false;
+        if(dtree.countInRange(disc, disc + 500) != int(std::distance(live.lower_bound(disc), live.upper_bound(disc + 500)))) return false;
+    }
+    int free = dtree.lowestFree();
+    return free != INVALID_DISC && live.count(free) == 0 && (free == MIN_DISC || live.count(free - 1) == 1);
+}
+
+//A DTree switches to dense mode once full enough and back once sparse again,
+//answering the same way in both, and snapshots and copies keep its users.
+bool Tester::testDenseMode() {
+    UTree utree;
+    DTree* dtree;
+    std::set<int> live;
+    DNode* removed;
+    for(int i = 0; live.size() < DENSE_ENTER - 1; i++) {
+        int disc = RANDDISC;
+        if(utree.insert(Account("Dense", disc, 0, "", ""))) live.insert(disc);
+    }
+    dtree = utree.retrieve("Dense")->getDTree();
+    if(dtree->isDense() || !sameUsers(*dtree, live)) return false;
+    while(live.size() < DENSE_ENTER + 1000) {
+        int disc = RANDDISC;
+        if(utree.insert(Account("Dense", disc, 1, "dense", ""))) live.insert(disc);
+    }
+    if(!dtree->isDense() || !sameUsers(*dtree, live)) return false;
+    if(utree.insert(Account("Dense", *live.begin(), 0, "", ""))) return false;
+
+    //copies and snapshots hold the same users
+    DTree copy;
+    copy = *dtree;
+    if(!copy.isDense() || !sameUsers(copy, live)) return false;
+    utree.insert(Account("Other", 1, 0, "", ""));
+    utree.saveSnapshot("mytest.snap");
+    UTree restored;
+    restored.loadSnapshot("mytest.snap");
+    SnapshotView view("mytest.snap");
+    std::remove("mytest.snap");
+    Account found;
+    if(capture(utree) != capture(restored) || view.numUsers("Dense") != int(live.size())
+       || !view.retrieveUser("Dense", *live.rbegin(), found)) return false;
+
+    //removing stays dense down to DENSE_LEAVE users
+    while(live.size() > DENSE_LEAVE) {
+        auto victim = live.lower_bound(RANDDISC);
+        if(victim == live.end()) continue;
+        utree.removeUser("Dense", *victim, removed);
+        live.erase(victim);
+    }
+    bool stayedDense = dtree->isDense() && sameUsers(*dtree, live);
+    utree.removeUser("Dense", *live.begin(), removed);
+    live.erase(live.begin());
+    return stayedDense && !dtree->isDense() && sameUsers(*dtree, live) && removed->isVacant();
+}
+
+//A search made while globals are being set up, before main
+static bool earlySearch() {
+    UTree utree;
+    utree.insert(Account("Early", 42, 0, "", ""));
+    return utree.retrieveUser("Early", 42) != nullptr && utree.retrieveUser("Early", 43) == nullptr;
+}
+static bool searchedEarly = earlySearch();
+
+//Small DTrees live in sorted arrays up to SMALL_CUTOFF users and answer
+//the same way as nodes, and every search version finds the same slots.
+bool Tester::testSmallMode() {
+    if(!searchedEarly) return false;
+    int16_t discs[SMALL_CUTOFF];
+    bool avx2 = string(DTree::smallSearch()) == "avx2";
+    for(int count = 0; count <= SMALL_CUTOFF; count++) {
+        std::set<int> picked;
+        while(int(picked.size()) < count) picked.insert(RANDDISC);
+        std::fill(discs, discs + SMALL_CUTOFF, INVALID_DISC);
+        std::copy(picked.begin(), picked.end(), discs);
+        for(int disc : {INVALID_DISC, MIN_DISC, MAX_DISC, MAX_DISC + 1, 70000, RANDDISC, count > 0 ? discs[count - 1] : 0}) {
+            int expected = -1;
+            for(int i = 0; i < count; i++) if(discs[i] == disc) expected = i;
+            if(DTree::findScalar(discs, count, disc) != expected || DTree::findSSE2(discs, count, disc) != expected
+               || (avx2 && DTree::findAVX2(discs, count, disc) != expected)) return false;
+        }
+    }
+
+    UTree utree;
+    std::set<int> live;
+    DNode* removed;
+    while(int(live.size()) < SMALL_CUTOFF) {
+        int disc = RANDDISC;
+        if(utree.insert(Account("Small", disc, 0, "", ""))) live.insert(disc);
+    }
+    DTree* dtree = utree.retrieve("Small")->getDTree();
+    if(!dtree->isSmall() || !sameUsers(*dtree, live) || utree.insert(Account("Small", *live.begin(), 0, "", ""))) return false;
+    //a user's node keeps its address through every change and mode switch
+    int held = *live.begin();
+    DNode* heldNode = utree.retrieveUser("Small", held);
+    for(int n = 0; n < 200; n += 13) {
+        int free = dtree->nthFree(n);
+        if(live.count(free) == 1 || std::distance(live.begin(), live.lower_bound(free)) + n != free - MIN_DISC) return false;
+    }
+    //one past the cutoff goes to nodes, a remove with SMALL_LEAVE left comes back
+    while(int(live.size()) == SMALL_CUTOFF) {
+        int disc = RANDDISC;
+        if(utree.insert(Account("Small", disc, 0, "", ""))) live.insert(disc);
+    }
+    if(dtree->isSmall() || !sameUsers(*dtree, live)) return false;
+    while(int(live.size()) > SMALL_LEAVE) {
+        int victim = *std::next(live.begin(), live.size() / 2);
+        if(!utree.removeUser("Small", victim, removed) || removed->getDiscriminator() != victim) return false;
+        live.erase(victim);
+    }
+    if(dtree->isSmall() || !sameUsers(*dtree, live)) return false;
+    int victim = *live.rbegin();
+    utree.removeUser("Small", victim, removed);
+    live.erase(victim);
+    if(!dtree->isSmall() || !sameUsers(*dtree, live) || !removed->isVacant() || removed->getDiscriminator() != victim) return false;
+
+    //snapshots keep small trees small
+    utree.saveSnapshot("mytest.snap");
+    UTree restored;
+    restored.loadSnapshot("mytest.snap");
+    std::remove("mytest.snap");
+    if(!restored.retrieve("Small")->getDTree()->isSmall() || capture(utree) != capture(restored)) return false;
+    if(utree.retrieveUser("Small", held) != heldNode || heldNode->getDiscriminator() != held) return false;
+
+    //the last remove takes the username with it
+    while(!live.empty()) {
+        if(!utree.removeUser("Small", *live.begin(), removed)) return false;
+        live.erase(live.begin());
+    }
+    return utree.retrieve("Small") == nullptr && removed->getUsername() == "Small";
+}
+
+//Removes keep the vacant share of a DTree bounded instead of letting dead
+//nodes pile up, the stats see every node dropped, and a tree's compaction
+//policy is its own.
+bool Tester::testCompaction() {
+    DTree dtree;
+    std::set<int> live;
+    DNode* removed;
+    for(int disc = 0; disc < 3000; disc++) {
+        dtree.insert(Account("", disc, 0, "", ""));
+        live.insert(disc);
+    }
+    Stats before = Stats::snapshot();
+    for(int i = 0; i < 2500; i++) {
+        auto victim = live.lower_bound(RANDDISC % 3000);
+        if(victim == live.end()) continue;
+        if(!dtree.remove(*victim, removed)) return false;
+        live.erase(victim);
+        if(dtree._root->_numVacant * 100 > COMPACT_PERCENT * dtree._root->_size + 100) return false;
+    }
+    if(checkSizes(dtree._root) == -1 || !sameUsers(dtree, live)) return false;
+    Stats after = Stats::snapshot();
+    uint64_t reclaimed = after.vacantReclaimed - before.vacantReclaimed;
+    if(Stats::enabled() && (reclaimed == 0 || after.reclaimedBytes - before.reclaimedBytes < reclaimed * sizeof(DNode))) return false;
+    for(auto bad : {std::array<int, 2>{-1, 10}, {101, 10}, {50, -1}}) {
+        try {
+            CompactPolicy(bad[0], bad[1]);
+            return false;
+        } catch(const std::invalid_argument&) {}
+    }
+
+    //with compaction off the vacant nodes stay until compact
+    DTree kept;
+    kept.setCompaction(CompactPolicy(0, COMPACT_BUDGET));
+    for(int disc = 0; disc < 100; disc++) kept.insert(Account("", disc, 0, "", ""));
+    for(int disc = 0; disc < 90; disc++) kept.remove(disc, removed);
+    if(kept._root->_numVacant != 90 || kept.compact() != 90) return false;
+
+    int vacant = dtree._root->_numVacant;
+    return dtree.compact() == vacant && dtree._root->_numVacant == 0 && dtree._root->_size == int(live.size());
+}
+
+//Returns the height of node, -2 if the subtree is out of order, has a wrong
+//height or is not AVL balanced.
+int Tester::checkAVL(UNode* node, const string* low, const string* high) {
+    if(node == nullptr) return -1;
+    if((low != nullptr && node->_username <= *low) || (high != nullptr && node->_username >= *high)) return -2;
+    int left = checkAVL(node->_left, low, &node->_username);
+    int right = checkAVL(node->_right, &node->_username, high);
+    if(left == -2 || right == -2 || left - right > 1 || right - left > 1) return -2;
+    int height = 1 + std::max(left, right);
+    return node->_height == height ? height : -2;
+}
+
+//Removing the last account of many usernames keeps the UTree a valid AVL
+//tree and leaves every other username in place.
+bool Tester::testRemoveUsers() {
+    UTree utree;
+    std::vector<string> names;
+    for(int i = 0; i < 3000; i++) {
+        names.push_back("Remove" + std::to_string(i));
+        utree.insert(Account(names.back(), i % 100, 0, "", ""));
+    }
+    std::shuffle(names.begin(), names.end(), rng);
+    DNode* removed;
+    for(int i = 0; i < 2000; i++) {
+        int disc = std::stoi(names[i].substr(6)) % 100;
+        if(!utree.removeUser(names[i], disc, removed) || removed == nullptr || removed->getDiscriminator() != disc) return false;
+        if(utree.retrieve(names[i]) != nullptr) return false;
+        if(i % 100 == 0 && checkAVL(utree._root, nullptr, nullptr) == -2) return false;
+    }
+    for(int i = 2000; i < 3000; i++) {
+        if(utree.numUsers(names[i]) != 1) return false;
+    }
+    return checkAVL(utree._root, nullptr, nullptr) != -2 && utree._unodes.size() == 1000;
+}
+
+//A batch gives the same results and leaves the same accounts as applying
+//its ops one at a time, for new usernames, big runs and small runs alike.
+bool Tester::testApplyBatch() {
+    UTree batched, sequential;
+    batched.loadData("accounts.csv");
+    sequential.loadData("accounts.csv");
+    for(int disc = 0; disc < 400; disc++) {
+        batched.insert(Account("Large", disc, 0, "", ""));
+        sequential.insert(Account("Large", disc, 0, "", ""));
+    }
+
+    string names[] = {"Large", "Batch0", "Batch1", "Batch2", "Capstan"};
+    std::stringstream expectedOut, batchedOut;
+    bool sameResults = true;
+    //the small batch applies op by op to "Large", the big one rebuilds it
+    for(int size : {3000, 20}) {
+        std::vector<BatchOp> ops;
+        for(int i = 0; i < size; i++) {
+            const string& name = names[i % 5];
+            int disc = (name == "Large" ? RANDDISC % 420 : RANDDISC % 40);
+            int type = (RANDDISC % 3 == 0 ? BATCH_REMOVE : BATCH_INSERT);
+            ops.push_back(BatchOp{type, Account(name, disc, disc % 2, "batch", std::to_string(i))});
+        }
+        //a username emptied by the batch
+        ops.push_back(BatchOp{BATCH_INSERT, Account("Emptied", 1, 0, "", "")});
+        ops.push_back(BatchOp{BATCH_REMOVE, Account("Emptied", 1, 0, "", "")});
+
+        std::vector<bool> expected;
+        DNode* removed;
+        for(const BatchOp& op : ops) {
+            if(op.type == BATCH_INSERT) expected.push_back(sequential.insert(op.account));
+            else expected.push_back(sequential.removeUser(op.account.getUsername(), op.account.getDiscriminator(), removed));
+        }
+        sameResults = sameResults && batched.applyBatch(ops) == expected;
+    }
+
+    std::streambuf* old = cout.rdbuf(expectedOut.rdbuf());
+    sequential.printUsers();
+    cout.rdbuf(batchedOut.rdbuf());
+    batched.printUsers();
+    cout.rdbuf(old);
+    return sameResults && expectedOut.str() == batchedOut.str()
+        && batched.retrieve("Emptied") == nullptr && checkAVL(batched._root, nullptr, nullptr) != -2;
+}
+
+//A frozen copy answers every lookup the way the UTree does, including
+//usernames that only differ after their first 16 bytes.
+bool Tester::testFreeze() {
+    UTree utree;
+    utree.loadData("accounts.csv");
+    for(int i = 0; i < 200; i++) {
+        utree.insert(Account("SameFirstSixteen" + std::to_string(i % 20), RANDDISC, 0, "", ""));
+        utree.insert(Account("Short" + std::to_string(i), RANDDISC, 0, "", ""));
+    }
+    FrozenUTree frozen = utree.freeze();
+
+    std::vector<UNode*> stack;
+    int numNames = 0;
+    for(UNode* node = utree._root; node != nullptr || !stack.empty(); node = node->_right) {
+        for(; node != nullptr; node = node->_left) stack.push_back(node);
+        node = stack.back();
+        stack.pop_back();
+        numNames++;
+        const string& name = node->getUsername();
+        if(frozen.numUsers(name) != utree.numUsers(name)) return false;
+        for(int i = 0; i < 50; i++) {
+            int disc = (i % 2 == 0 && node->_dtree->getNumUsers() > 0 ? node->_dtree->select(i % node->_dtree->getNumUsers())->getDiscriminator() : RANDDISC);
+            DNode* expected = utree.retrieveUser(name, disc);
+            const Account* found = frozen.retrieveUser(name, disc);
+            if((expected == nullptr) != (found == nullptr)) return false;
+            if(found != nullptr && (found->getBadge() != expected->getAccount().getBadge() || found->getDiscriminator() != disc)) return false;
+        }
+    }
+    for(string missing : {"", "A", "SameFirstSixteen", "SameFirstSixteen99", "zzzz", "Short"}) {
+        if(frozen.numUsers(missing) != utree.numUsers(missing) || frozen.retrieveUser(missing, 1) != nullptr) return false;
+    }
+    return frozen.numUsernames() == numNames;
+}
+
+//Prefix searches on the tree and on the front coded index list the same
+//usernames as a brute force pass over every username.
+bool Tester::testPrefixScan() {
+    UTree utree;
+    std::map<string, int> names;
+    const string letters = "abc";
+    for(int i = 0; i < 3000; i++) {
+        string name;
+        for(int length = rand() % 8; length > 0; length--) name += letters[rand() % letters.size()];
+        if(name.empty()) continue;
+        if(utree.insert(Account(name, RANDDISC, 0, "", ""))) names[name]++;
+    }
+    PrefixIndex index(utree);
+    if(index.numUsernames() != int(names.size())) return false;
+
+    std::vector<string> prefixes = {"", "a", "abc", "cccccccc", "d", "0"};
+    for(int i = 0; i < 300; i++) prefixes.push_back(std::next(names.begin(), rand() % names.size())->first.substr(0, rand() % 6));
+    for(const string& prefix : prefixes) {
+        for(int limit : {0, 1, 5, 100000}) {
+            std::vector<PrefixMatch> expected;
+            for(auto it = names.lower_bound(prefix); it != names.end() && int(expected.size()) < limit
+                && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+                expected.push_back({it->first, it->second});
+            }
+            std::vector<PrefixMatch> scanned = utree.prefixScan(prefix, limit);
+            std::vector<PrefixMatch> completed = index.complete(prefix, limit);
+            if(scanned.size() != expected.size() || completed.size() != expected.size()) return false;
+            for(size_t k = 0; k < expected.size(); k++) {
+                if(scanned[k].username != expected[k].username || scanned[k].numUsers != expected[k].numUsers
+                   || completed[k].username != expected[k].username || completed[k].numUsers != expected[k].numUsers) return false;
+            }
+        }
+    }
+    UTree empty;
+    return empty.prefixScan("", 10).empty() && PrefixIndex(empty).complete("", 10).empty();
+}
+
+//Iterators visit the same accounts, in order, as the model of what was
+//inserted and removed, in every DTree mode, and hand out the stored accounts.
+bool Tester::testIterators() {
+    UTree utree;
+    std::set<std::pair<string, int>> live;
+    DNode* removed;
+    const int sizes[] = {1, 5, SMALL_CUTOFF + 40, DENSE_ENTER + 10};
+    for(int n = 0; n < 40; n++) {
+        string name = "user" + std::to_string(n);
+        int size = sizes[n % 4] + n;
+        int added = 0;
+        while(added < size) {
+            int disc = RANDDISC;
+            if(utree.insert(Account(name, disc, 0, "", ""))) {
+                live.insert({name, disc});
+                added++;
+            }
+        }
+        //leave vacant nodes and whole vacant subtrees behind
+        for(int i = 0; i < size / 3; i++) {
+            auto victim = live.lower_bound({name, RANDDISC});
+            if(victim == live.end() || victim->first != name) continue;
+            utree.removeUser(name, victim->second, removed);
+            live.erase(victim);
+        }
+    }
+
+    auto matches = [&](auto first, auto last, auto from, auto to) {
+        for(; first != last && from != to; ++first, ++from) {
+            if(first->getUsername() != from->first || first->getDiscriminator() != from->second
+               || &*first != &utree.retrieveUser(from->first, from->second)->getAccount()) return false;
+        }
+        return first == last && from == to;
+    };
+    if(!matches(utree.begin(), utree.end(), live.begin(), live.end())) return false;
+    for(int i = 0; i < 40; i++) {
+        string from = "user" + std::to_string(rand() % 45);
+        string to = (i % 5 == 0 ? "" : "user" + std::to_string(rand() % 45) + (i % 2 ? "" : "x"));
+        UTree::Range range = utree.range(from, to);
+        auto first = live.lower_bound({from, INVALID_DISC});
+        auto last = (to < from ? first : live.lower_bound({to, INVALID_DISC}));
+        if(!matches(range.begin(), range.end(), first, last)) return false;
+    }
+
+    //a DTree with vacant nodes on its own
+    DTree dtree;
+    std::set<int> discs;
+    for(int i = 0; i < 500; i++) {
+        int disc = RANDDISC;
+        if(dtree.insert(Account("", disc, 0, "", ""))) discs.insert(disc);
+    }
+    for(int i = 0; i < 300; i++) {
+        auto victim = discs.lower_bound(RANDDISC);
+        if(victim == discs.end()) continue;
+        dtree.remove(*victim, removed);
+        discs.erase(victim);
+    }
+    auto disc = discs.begin();
+    for(const Account& acct : dtree) {
+        if(disc == discs.end() || acct.getDiscriminator() != *disc++) return false;
+    }
+    DTree empty;
+    return disc == discs.end() && empty.begin() == empty.end() && UTree().begin() == UTree().end();
+}
+
+//CSV and snapshot exports load back into the same tree, JSON lines are
+//escaped, and fields CSV can't hold are refused.
+bool Tester::testExport() {
+    UTree utree;
+    utree.loadData("accounts.csv");
+    {
+        FileSink csv("mytest_export.csv", 100);
+        utree.exportTo(csv, EXPORT_CSV);
+        FileSink snap("mytest_export.snap");
+        utree.exportTo(snap, EXPORT_SNAPSHOT);
+    }
+    UTree fromCsv, fromSnap;
+    fromCsv.loadData("mytest_export.csv");
+    fromSnap.loadSnapshot("mytest_export.snap");
+    std::remove("mytest_export.csv");
+    std::remove("mytest_export.snap");
+    //the sorted CSV is bulk built, so only the accounts have to match, not the shape
+    auto sameAccount = [](const Account& a, const Account& b) {
+        return a.getUsername() == b.getUsername() && a.getDiscriminator() == b.getDiscriminator()
+            && a.hasNitro() == b.hasNitro() && a.getBadge() == b.getBadge() && a.getStatus() == b.getStatus();
+    };
+    if(!std::equal(utree.begin(), utree.end(), fromCsv.begin(), fromCsv.end(), sameAccount)
+       || capture(fromSnap) != capture(utree)) return false;
+
+    StringSink json;
+    utree.exportTo(json, EXPORT_JSON);
+    int lines = std::count(json.data().begin(), json.data().end(), '\n');
+    int accounts = std::distance(utree.begin(), utree.end());
+    UTree quoted;
+    quoted.insert(Account("Quote\"d", 7, 1, "a\\b", "line\nbreak,comma"));
+    StringSink one;
+    quoted.exportTo(one, EXPORT_JSON);
+    if(lines != accounts || one.data() != "{\"username\":\"Quote\\\"d\",\"disc\":7,\"nitro\":true,"
+                                          "\"badge\":\"a\\\\b\",\"status\":\"line\\u000abreak,comma\"}\n") return false;
+    try {
+        StringSink csv;
+        quoted.exportTo(csv, EXPORT_CSV);
+        return false;
+    } catch(const std::invalid_argument&) {
+        return true;
+    }
+}
+
+//A trace holds every public call in order, and applying it to an empty
+//tree rebuilds the traced one. A trace cut short keeps its whole records.
+bool Tester::testTrace() {
+    UTree utree;
+    DNode* removed;
+    {
+        TraceRecorder tracer("mytest.trace");
+        utree.setTracer(&tracer);
+        utree.loadData("accounts.csv", false);
+        utree.insert(Account("Traced", 42, 1, "Badge", "line\nbreak"));
+        utree.insert(Account("Traced", 42, 0, "", ""));
+        utree.removeUser("Traced", 42, removed);
+        utree.removeUser("Missing", INVALID_DISC, removed);
+        utree.insert(Account("Traced", 7, 0, "", ""));
+        utree.retrieve("Traced");
+        utree.retrieveUser("Traced", 7);
+        utree.numUsers("Traced");
+        utree.setTracer(nullptr);
+        utree.numUsers("Untraced");
+    }
+    std::vector<TraceOp> ops = TraceRecorder::load("mytest.trace");
+    const int types[] = {TRACE_LOAD, TRACE_INSERT, TRACE_INSERT, TRACE_REMOVE, TRACE_REMOVE, TRACE_INSERT,
+                         TRACE_RETRIEVE, TRACE_RETRIEVE_USER, TRACE_NUM_USERS};
+    if(ops.size() != 9) return false;
+    for(int i = 0; i < 9; i++) {
+        if(ops[i].type != types[i] || (i > 0 && ops[i].time < ops[i - 1].time)) return false;
+    }
+    if(ops[0].username != "accounts.csv" || ops[0].append || ops[1].status != "line\nbreak" || !ops[1].nitro
+       || ops[4].disc != INVALID_DISC || ops[7].disc != 7) return false;
+
+    UTree replayed;
+    for(const TraceOp& op : ops) TraceRecorder::apply(op, replayed);
+    if(capture(replayed) != capture(utree)) return false;
+
+    //drop the last 3 bytes, the last record goes and the rest stay
+    std::ifstream in("mytest.trace", std::ios::binary);
+    string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream("mytest.trace", std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() - 3);
+    bool truncated = TraceRecorder::load("mytest.trace").size() == 8;
+    std::remove("mytest.trace");
+    return truncated;
+}
+
+//Histogram buckets cover every value once, and with UTREE_STATS the counts
+//follow the calls made, threads that exited included. Without it they stay 0.
+bool Tester::testStats() {
+    for(int b = 1; b < HIST_BUCKETS; b++) {
+        if(Histogram::bucketLow(b) != Histogram::bucketHigh(b - 1) + 1) return false;
+    }
+    for(uint64_t value : {uint64_t(0), uint64_t(15), uint64_t(16), uint64_t(1000), uint64_t(123456789), ~uint64_t(0)}) {
+        int b = Histogram::bucketOf(value);
+        if(value < Histogram::bucketLow(b) || value > Histogram::bucketHigh(b)) return false;
+        if(value >= HIST_SUB_BUCKETS && Histogram::bucketHigh(b) - Histogram::bucketLow(b) > value / HIST_SUB_BUCKETS) return false;
+    }
+
+    Stats::reset();
+    UTree utree;
+    for(int i = 0; i < 100; i++) utree.insert(Account("stats" + std::to_string(1000 + i), 1, 0, "", ""));
+    for(int disc = 0; disc < 500; disc++) utree.insert(Account("Stats", disc, 0, "", ""));
+    DNode* removed;
+    for(int disc = 0; disc < 400; disc++) utree.removeUser("Stats", disc, removed);
+    utree.retrieve("Stats")->getDTree()->compact();
+    std::thread reader([&]() {
+        for(int i = 0; i < 10; i++) utree.retrieveUser("Stats", 450);
+    });
+    reader.join();
+    Stats stats = Stats::snapshot();
+    if(!Stats::enabled()) {
+        return stats.rotations == 0 && stats.nodeAllocations == 0 && stats.latency[STATS_INSERT].count == 0;
+    }
+
+    const Histogram& inserts = stats.latency[STATS_INSERT];
+    if(inserts.count != 600 || stats.latency[STATS_REMOVE].count != 400
+       || stats.latency[STATS_RETRIEVE].count != 1 || stats.latency[STATS_RETRIEVE_USER].count != 10) return false;
+    if(inserts.percentile(50) > inserts.percentile(99) || inserts.percentile(100) != inserts.max) return false;
+    //sorted usernames rotate, sorted discriminators past the small cutoff rebuild
+    if(stats.rotations == 0 || stats.rebuilds == 0 || stats.rebuildSizes.count != stats.rebuilds) return false;
+    if(stats.vacantReclaimed < 400 - SMALL_CUTOFF || stats.nodeAllocations < 600) return false;
+    if(stats.comparisonsPerUTreeLookup() < 1 || stats.comparisonsPerDTreeLookup() <= 0) return false;
+    Stats::reset();
+    return Stats::snapshot().latency[STATS_RETRIEVE_USER].count == 0;
+}
+
+//Every balance policy keeps sizes right and every user findable, the
+//weight rule bounds depth, and a scapegoat tree rebuilds less than Discord.
+//A policy belongs to the tree it is set on.
+bool Tester::testBalancePolicies() {
+    const int policies[][3] = {{BALANCE_DISCORD, 3, 2}, {BALANCE_WEIGHT, 2, 3}, {BALANCE_SCAPEGOAT, 2, 3}};
+    uint64_t rebuilt[3];
+    for(int p = 0; p < 3; p++) {
+        DTree dtree;
+        dtree.setBalance(BalancePolicy(policies[p][0], BALANCE_MIN_SIZE, policies[p][1], policies[p][2]));
+        std::set<int> live;
+        uint64_t before = Stats::snapshot().rebuildSizes.sum;
+        for(int disc = 0; disc < 3000; disc++) {
+            dtree.insert(Account("", disc, 0, "", ""));
+            live.insert(disc);
+        }
+        rebuilt[p] = Stats::snapshot().rebuildSizes.sum - before;
+        if(checkSizes(dtree._root) == -1 || !sameUsers(dtree, live)) return false;
+        //log base 3/2 of 3000 is under 20
+        if(policies[p][0] != BALANCE_DISCORD && dtree.averageDepth() > 20) return false;
+    }
+    if(Stats::enabled() && rebuilt[2] >= rebuilt[0]) return false;
+
+    for(auto bad : {std::array<int, 4>{3, 4, 3, 2}, {BALANCE_DISCORD, 4, 2, 3}, {BALANCE_WEIGHT, 4, 1, 3},
+                    {BALANCE_SCAPEGOAT, 4, 1, 1}, {BALANCE_WEIGHT, -1, 2, 3}}) {
+        try {
+            BalancePolicy(bad[0], bad[1], bad[2], bad[3]);
+            return false;
+        } catch(const std::invalid_argument&) {}
+    }
+
+    //a UTree hands its policy to the DTrees it has and the ones it makes
+    BalancePolicy weight(BALANCE_WEIGHT, BALANCE_MIN_SIZE, 2, 3);
+    UTree weighted, plain;
+    weighted.insert(Account("before", 1, 0, "", ""));
+    weighted.setBalance(weight);
+    weighted.insert(Account("after", 1, 0, "", ""));
+    plain.insert(Account("before", 1, 0, "", ""));
+    for(const char* name : {"before", "after"}) {
+        if(weighted.retrieve(name)->getDTree()->getBalance().rule() != BALANCE_WEIGHT) return false;
+    }
+    if(plain.retrieve("before")->getDTree()->getBalance().rule() != BALANCE_DISCORD) return false;
+
+    DTree dtree;
+    for(int disc = 0; disc < 100; disc++) dtree.insert(Account("", disc, 0, "", ""));
+    return dtree.averageDepth() < 7;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+//Inserts discriminators in order (worst case for a BST) and checks that
+//every node's _size/_numVacant still matches its subtree.
+bool Tester::testDTreeSizes(DTree& dtree) {
+    DNode* removed;
+    for(int disc = 0; disc < 1000; disc++) {
+        dtree.insert(Account("", disc, 0, "", ""));
+        if(disc % 3 == 0) dtree.remove(disc, removed);
+    }
+    for(int disc = 0; disc < 1000; disc += 3) {
+        dtree.insert(Account("", disc, 0, "", ""));
+    }
+    return checkSizes(dtree._root) != -1 && dtree.getNumUsers() == 1000;
+}
+
+int Tester::checkSizes(DNode* node) {
+    if(node == nullptr) return 0;
+    int left = checkSizes(node->_left);
+    int right = checkSizes(node->_right);
+    if(left == -1 || right == -1 || node->_size != left + right + 1) return -1;
+    int vacant = node->isVacant() ? 1 : 0;
+    if(node->_left != nullptr) vacant += node->_left->_numVacant;
+    if(node->_right != nullptr) vacant += node->_right->_numVacant;
+    if(node->_numVacant != vacant) return -1;
+    return node->_size;
+}
+
 ///////////////////////////////////////////////////////////////////////////
 
 int main() {
@@ -156,6 +1094,16 @@ int main() {
     }
     }
 
+    {
+    cout << "\n\t\tTESTING DTREE SIZES ALONG THE INSERTION PATH:" << endl;
+    DTree stree;
+    if(tester.testDTreeSizes(stree)) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+    }
+
 /////////////////////////////////////////////////////////////////////////////////////////
 
 //Test UNode insertion
@@ -175,6 +1123,167 @@ int main() {
     cout << "\tResulting UTree printed Accounts..." << endl;
     utree.printUsers();
     
+    cout << "\n\tTesting that the mapped loader matches loadData..." << endl;
+    if(tester.testMappedLoad()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting that the parallel loader matches loadData..." << endl;
+    if(tester.testParallelLoad()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting bulk build from sorted accounts..." << endl;
+    if(tester.testBuildFromSorted()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting snapshot save and restore..." << endl;
+    if(tester.testSnapshot(utree)) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting journal recovery..." << endl;
+    if(tester.testJournal()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting a journal replay that throws..." << endl;
+    if(tester.testJournalFailedReplay()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting concurrent reads during writes..." << endl;
+    if(tester.testConcurrentReads()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting sharded UTree..." << endl;
+    if(tester.testShardedUTree()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting DTree order statistics..." << endl;
+    if(tester.testOrderStatistics()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting discriminator allocation..." << endl;
+    if(tester.testAllocateDiscriminator()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting dense DTree mode..." << endl;
+    if(tester.testDenseMode()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting compaction of vacant nodes..." << endl;
+    if(tester.testCompaction()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting small DTree mode..." << endl;
+    if(tester.testSmallMode()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting removal of whole usernames..." << endl;
+    if(tester.testRemoveUsers()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting batched operations..." << endl;
+    if(tester.testApplyBatch()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting frozen UTree lookups..." << endl;
+    if(tester.testFreeze()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting prefix search..." << endl;
+    if(tester.testPrefixScan()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting iterators and range scans..." << endl;
+    if(tester.testIterators()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting export formats..." << endl;
+    if(tester.testExport()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting trace recording and replay..." << endl;
+    if(tester.testTrace()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting operation counters and latency histograms..." << endl;
+    if(tester.testStats()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting balance policies..." << endl;
+    if(tester.testBalancePolicies()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
+    cout << "\n\tTesting a failed ConcurrentUTree write..." << endl;
+    if(tester.testConcurrentFailedWrite()) {
+        cout << "\t\tTest Passed!" << endl;
+    } else {
+        cout << "\t\tTest Failed!" << endl;
+    }
+
     cout << "\n\tTesting insertion of node that already exists..." << endl;
     Account newAccount = Account("Kippage",5482, 0, "", "");
     if(utree.insert(newAccount)){
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "stats.h"
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#define POOL_BLOCK_SIZE 256
+
+/**
+ * Slab allocator for tree nodes. Nodes are carved out of contiguous blocks of
+ * POOL_BLOCK_SIZE slots, freed slots go on a free list to be handed out again
+ * and release() returns every block at once instead of freeing node by node.
+**/
+template <class T>
+class NodePool {
+public:
+    NodePool(): _blocks(nullptr), _free(nullptr), _live(0) {}
+    ~NodePool() {release();}
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    /* Constructs a T in the next free slot */
+    template <class... Args>
+    T* create(Args&&... args);
+
+    /* Destroys a T and puts its slot on the free list */
+    void destroy(T* obj);
+
+    /* Calls visit on every live object, in block order */
+    template <class Visit>
+    void forEach(Visit visit);
+
+    /* Destroys every live object and frees all blocks */
+    void release();
+
+    /* Takes over every block of other, leaving other empty. Objects keep
+     * their addresses, nothing is copied */
+    void adopt(NodePool& other);
+
+    int size() const {return _live;}
+
+private:
+    struct Slot {
+        Slot* next;
+        bool live;
+        alignas(T) unsigned char obj[sizeof(T)];
+    };
+    struct Block {
+        Block* next;
+        int used;       /* slots handed out so far */
+        Slot slots[POOL_BLOCK_SIZE];
+    };
+
+    Block* _blocks;     /* most recent block first */
+    Slot* _free;
+    int _live;
+
+    static Slot* toSlot(T* obj) {
+        return reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(obj) - offsetof(Slot, obj));
+    }
+};
+
+template <class T>
+template <class... Args>
+T* NodePool<T>::create(Args&&... args) {
+    Slot* slot;
+    if(_free != nullptr) {
+        slot = _free;
+        _free = slot->next;
+    } else {
+        if(_blocks == nullptr || _blocks->used == POOL_BLOCK_SIZE) {
+            Block* block = static_cast<Block*>(::operator new(sizeof(Block)));
+            block->next = _blocks;
+            block->used = 0;
+            _blocks = block;
+        }
+        slot = &_blocks->slots[_blocks->used++];
+    }
+    T* obj = new (slot->obj) T(std::forward<Args>(args)...);
+    STATS_COUNT(nodeAllocations);
+    slot->live = true;
+    _live++;
+    return obj;
+}
+
+template <class T>
+void NodePool<T>::destroy(T* obj) {
+    if(obj == nullptr) return;
+    obj->~T();
+    Slot* slot = toSlot(obj);
+    slot->live = false;
+    slot->next = _free;
+    _free = slot;
+    _live--;
+}
+
+template <class T>
+template <class Visit>
+void NodePool<T>::forEach(Visit visit) {
+    for(Block* block = _blocks; block != nullptr; block = block->next) {
+        for(int i = 0; i < block->used; i++) {
+            if(block->slots[i].live) visit(reinterpret_cast<T*>(block->slots[i].obj));
+        }
+    }
+}
+
+template <class T>
+void NodePool<T>::release() {
+    /* Objects still get their destructors (Accounts own strings), but the
+     * memory itself goes back one block at a time */
+    forEach([](T* obj) {obj->~T();});
+    while(_blocks != nullptr) {
+        Block* next = _blocks->next;
+        ::operator delete(_blocks);
+        _blocks = next;
+    }
+    _free = nullptr;
+    _live = 0;
+}
+
+template <class T>
+void NodePool<T>::adopt(NodePool& other) {
+    if(other._blocks == nullptr) return;
+    /* Partly used blocks stay behind our head block, new objects keep
+     * coming from the head */
+    Block* last = other._blocks;
+    while(last->next != nullptr) last = last->next;
+    if(_blocks == nullptr) {
+        _blocks = other._blocks;
+    } else {
+        last->next = _blocks->next;
+        _blocks->next = other._blocks;
+    }
+    if(other._free != nullptr) {
+        Slot* tail = other._free;
+        while(tail->next != nullptr) tail = tail->next;
+        tail->next = _free;
+        _free = other._free;
+    }
+    _live += other._live;
+    other._blocks = nullptr;
+    other._free = nullptr;
+    other._live = 0;
+}
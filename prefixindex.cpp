@@ -0,0 +1,95 @@
+#include "prefixindex.h"
+#include <algorithm>
+
+/**
+ * Front codes every username of utree, walking it in order.
+ */
+PrefixIndex::PrefixIndex(const UTree& utree) {
+    std::vector<UNode*> stack;
+    string previous;
+    for(UNode* node = utree._root; node != nullptr || !stack.empty(); node = node->_right) {
+        for(; node != nullptr; node = node->_left) stack.push_back(node);
+        node = stack.back();
+        stack.pop_back();
+        const string& name = node->_username;
+        size_t shared = 0;
+        if(_numUsers.size() % PREFIX_BLOCK == 0) {
+            _blocks.push_back(_data.size());
+        } else {
+            size_t most = std::min(name.size(), previous.size());
+            while(shared < most && name[shared] == previous[shared]) shared++;
+        }
+        putVarint(_data, shared);
+        putVarint(_data, name.size() - shared);
+        _data.append(name, shared, string::npos);
+        _numUsers.push_back(node->_dtree->getNumUsers());
+        previous = name;
+    }
+    _data.shrink_to_fit();
+}
+
+/**
+ * Lists the usernames starting with prefix in order.
+ * @param prefix start every username has to share, "" matches all of them
+ * @param limit most usernames to return
+ * @return matching usernames in order, with their number of users
+ */
+std::vector<PrefixMatch> PrefixIndex::complete(std::string_view prefix, int limit) const {
+    std::vector<PrefixMatch> matches;
+    /* the first match is in the last block whose head is before prefix, or
+     * is the head of the block after it */
+    int low = 0, high = _blocks.size();
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(head(mid) < prefix) low = mid + 1;
+        else high = mid;
+    }
+    int block = std::max(low - 1, 0);
+    if(block >= int(_blocks.size())) return matches;
+
+    string name;
+    const char* at = _data.data() + _blocks[block];
+    const char* end = _data.data() + _data.size();
+    for(size_t index = size_t(block) * PREFIX_BLOCK; at < end && int(matches.size()) < limit; index++) {
+        uint32_t shared = getVarint(at);
+        uint32_t length = getVarint(at);
+        name.resize(shared);
+        name.append(at, length);
+        at += length;
+        if(std::string_view(name) < prefix) continue;
+        if(name.compare(0, prefix.size(), prefix) != 0) break;
+        matches.push_back({name, _numUsers[index]});
+    }
+    return matches;
+}
+
+size_t PrefixIndex::bytes() const {
+    return _data.capacity() + _blocks.capacity() * sizeof(uint32_t) + _numUsers.capacity() * sizeof(int32_t);
+}
+
+/**
+ * Username at the start of a block, stored whole.
+ */
+std::string_view PrefixIndex::head(int block) const {
+    const char* at = _data.data() + _blocks[block];
+    getVarint(at);
+    uint32_t length = getVarint(at);
+    return std::string_view(at, length);
+}
+
+void PrefixIndex::putVarint(string& out, uint32_t value) {
+    while(value >= 0x80) {
+        out.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(char(value));
+}
+
+uint32_t PrefixIndex::getVarint(const char*& at) {
+    uint32_t value = 0;
+    for(int shift = 0; ; shift += 7) {
+        unsigned char byte = *at++;
+        value |= uint32_t(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) return value;
+    }
+}
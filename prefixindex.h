@@ -0,0 +1,41 @@
+#pragma once
+
+#include "utree.h"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define PREFIX_BLOCK 16     /* usernames per front coded block */
+
+/**
+ * Compact read-only index of a UTree's usernames for autocomplete.
+ *
+ * Sorted usernames share most of their bytes with the one before them, so
+ * they are front coded: every PREFIX_BLOCK-th username is stored whole and
+ * starts a block, the rest store only how many bytes they share with the
+ * previous username and the bytes after those. A search binary searches
+ * the block heads, then decodes forward from one block. The index is a copy,
+ * build a new one to see later changes to the tree.
+ */
+class PrefixIndex {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    PrefixIndex(const UTree& utree);
+
+    /* Same answer as UTree::prefixScan */
+    std::vector<PrefixMatch> complete(std::string_view prefix, int limit) const;
+    int numUsernames() const {return _numUsers.size();}
+    /* Bytes held by the index */
+    size_t bytes() const;
+
+private:
+    string _data;                   /* blocks of varint shared, varint length, bytes */
+    std::vector<uint32_t> _blocks;  /* offset of each block in _data */
+    std::vector<int32_t> _numUsers; /* valid users of each username, in order */
+
+    std::string_view head(int block) const;
+    static void putVarint(string& out, uint32_t value);
+    static uint32_t getVarint(const char*& at);
+};
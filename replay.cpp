@@ -0,0 +1,162 @@
+#include "trace.h"
+#include "shardedutree.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/*
+ * Replays a trace written by TraceRecorder and prints a latency histogram
+ * for each operation type.
+ *
+ *   replay trace [threads] [--paced]
+ *
+ * One thread replays onto a UTree in trace order. More threads replay onto a
+ * ShardedUTree: each username's calls stay on one thread in trace order and
+ * every load runs alone between the calls around it. A ShardedUTree has no
+ * UNode lookup, so retrieve is replayed as numUsers there. --paced waits for
+ * each call's recorded time instead of replaying as fast as possible.
+ */
+
+#define NUM_BUCKETS 48      /* power of two buckets, up to about 3 days */
+#define BAR_WIDTH 40
+
+using Clock = std::chrono::steady_clock;
+
+const char* opNames[] = {"", "insert", "removeUser", "retrieve", "retrieveUser", "numUsers", "loadData"};
+
+/* Latency of every replayed call, by operation type */
+struct Latencies {
+    std::vector<uint64_t> samples[TRACE_LOAD + 1];
+
+    void merge(Latencies& other) {
+        for(int type = TRACE_INSERT; type <= TRACE_LOAD; type++) {
+            samples[type].insert(samples[type].end(), other.samples[type].begin(), other.samples[type].end());
+        }
+    }
+};
+
+/**
+ * Runs op and records how long it took, waiting for its recorded time first
+ * when paced.
+ */
+template <class Call>
+void timeOp(const TraceOp& op, Call call, Latencies& latencies, bool paced, Clock::time_point base) {
+    if(paced) std::this_thread::sleep_until(base + std::chrono::nanoseconds(op.time));
+    auto start = Clock::now();
+    call();
+    latencies.samples[op.type].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+void applySharded(const TraceOp& op, ShardedUTree& tree) {
+    Account found;
+    switch(op.type) {
+    case TRACE_INSERT:
+        tree.insert(Account(op.username, op.disc, op.nitro, op.badge, op.status));
+        break;
+    case TRACE_REMOVE:
+        tree.removeUser(op.username, op.disc);
+        break;
+    case TRACE_RETRIEVE:
+    case TRACE_NUM_USERS:
+        tree.numUsers(op.username);
+        break;
+    case TRACE_RETRIEVE_USER:
+        tree.retrieveUser(op.username, op.disc, found);
+        break;
+    case TRACE_LOAD:
+        if(!op.append) tree.clear();
+        tree.loadData(op.username);
+        break;
+    }
+}
+
+/**
+ * Replays ops on threads threads, splitting the trace at every load.
+ */
+Latencies replaySharded(const std::vector<TraceOp>& ops, int threads, bool paced) {
+    ShardedUTree tree;
+    std::vector<Latencies> perThread(threads);
+    Clock::time_point base = Clock::now();
+    std::hash<string> hash;
+    for(size_t first = 0; first < ops.size();) {
+        if(ops[first].type == TRACE_LOAD) {
+            timeOp(ops[first], [&]() {applySharded(ops[first], tree);}, perThread[0], paced, base);
+            first++;
+            continue;
+        }
+        size_t last = first;
+        std::vector<std::vector<size_t>> mine(threads);
+        for(; last < ops.size() && ops[last].type != TRACE_LOAD; last++) {
+            mine[hash(ops[last].username) % threads].push_back(last);
+        }
+        std::vector<std::thread> workers;
+        for(int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                for(size_t i : mine[t]) timeOp(ops[i], [&]() {applySharded(ops[i], tree);}, perThread[t], paced, base);
+            });
+        }
+        for(std::thread& worker : workers) worker.join();
+        first = last;
+    }
+    Latencies all;
+    for(Latencies& latencies : perThread) all.merge(latencies);
+    return all;
+}
+
+/**
+ * Prints the count, mean and percentiles of each operation type, then the
+ * number of calls in each power of two bucket of nanoseconds.
+ */
+void report(Latencies& latencies) {
+    for(int type = TRACE_INSERT; type <= TRACE_LOAD; type++) {
+        std::vector<uint64_t>& samples = latencies.samples[type];
+        if(samples.empty()) continue;
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        long long buckets[NUM_BUCKETS] = {};
+        for(uint64_t ns : samples) {
+            total += ns;
+            buckets[std::min(NUM_BUCKETS - 1, ns == 0 ? 0 : 64 - __builtin_clzll(ns))]++;
+        }
+        auto percentile = [&](int p) {return samples[std::min(samples.size() - 1, samples.size() * p / 100)];};
+        cout << opNames[type] << ": " << samples.size() << " calls, mean " << uint64_t(total / samples.size())
+             << " ns, p50 " << percentile(50) << " ns, p90 " << percentile(90) << " ns, p99 " << percentile(99)
+             << " ns, max " << samples.back() << " ns" << endl;
+        long long most = *std::max_element(buckets, buckets + NUM_BUCKETS);
+        for(int b = 0; b < NUM_BUCKETS; b++) {
+            if(buckets[b] == 0) continue;
+            cout << "\t< " << (uint64_t(1) << b) << " ns\t" << buckets[b] << "\t"
+                 << string(std::max<long long>(1, buckets[b] * BAR_WIDTH / most), '#') << endl;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << "usage: " << argv[0] << " trace [threads] [--paced]" << endl;
+        return 1;
+    }
+    int threads = 1;
+    bool paced = false;
+    for(int i = 2; i < argc; i++) {
+        if(strcmp(argv[i], "--paced") == 0) paced = true;
+        else threads = std::max(1, atoi(argv[i]));
+    }
+
+    std::vector<TraceOp> ops = TraceRecorder::load(argv[1]);
+    cout << "Replaying " << ops.size() << " calls on " << threads << (threads == 1 ? " thread" : " threads")
+         << (paced ? ", paced" : "") << endl;
+    Latencies latencies;
+    if(threads == 1) {
+        UTree utree;
+        Clock::time_point base = Clock::now();
+        for(const TraceOp& op : ops) timeOp(op, [&]() {TraceRecorder::apply(op, utree);}, latencies, paced, base);
+    } else {
+        latencies = replaySharded(ops, threads, paced);
+    }
+    report(latencies);
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include "shardedutree.h"
+#include "mappedfile.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <thread>
+
+/**
+ * Runs work(0) .. work(count - 1), each on its own thread.
+ */
+template <class Work>
+static void runEach(size_t count, Work work) {
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < count; i++) workers.emplace_back(work, i);
+    if(count > 0) work(0);
+    for(std::thread& worker : workers) worker.join();
+}
+
+ShardedUTree::ShardedUTree(int numShards):
+    _shards(numShards > 0 ? numShards : std::max(1u, std::thread::hardware_concurrency())) {}
+
+ShardedUTree::Shard& ShardedUTree::shardFor(std::string_view username) {
+    return _shards[std::hash<std::string_view>()(username) % _shards.size()];
+}
+
+const ShardedUTree::Shard& ShardedUTree::shardFor(std::string_view username) const {
+    return _shards[std::hash<std::string_view>()(username) % _shards.size()];
+}
+
+bool ShardedUTree::insert(Account newAcct) {
+    Shard& shard = shardFor(newAcct.getUsername());
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.tree.insert(std::move(newAcct));
+}
+
+bool ShardedUTree::removeUser(std::string_view username, int disc) {
+    Shard& shard = shardFor(username);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    DNode* removed;
+    return shard.tree.removeUser(username, disc, removed);
+}
+
+/**
+ * Copies the account with the given username and discriminator into found.
+ * @return true if the account exists and is not vacant
+ */
+bool ShardedUTree::retrieveUser(std::string_view username, int disc, Account& found) const {
+    const Shard& shard = shardFor(username);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    DNode* node = shard.tree.retrieveUser(username, disc);
+    if(node == nullptr || node->isVacant()) return false;
+    found = node->getAccount();
+    return true;
+}
+
+int ShardedUTree::numUsers(std::string_view username) const {
+    const Shard& shard = shardFor(username);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    return shard.tree.numUsers(username);
+}
+
+/**
+ * Adds every account in infile. Slices of the file are parsed in parallel
+ * without building a tree, then each shard sorts its own accounts and bulk
+ * loads them on its own thread. A malformed line throws before any shard
+ * is changed.
+ */
+void ShardedUTree::loadData(string infile) {
+    MappedFile file(infile);
+    if(!file.isOpen()) {
+        std::cerr << __FUNCTION__ << ": File " << infile << " could not be opened or located" << endl;
+        exit(-1);
+    }
+    std::vector<UTree::ParsedChunk> chunks = UTree::parseSlices(file.begin(), file.end(), _shards.size());
+    for(UTree::ParsedChunk& chunk : chunks) {
+        if(chunk.error) std::rethrow_exception(chunk.error);
+    }
+
+    /* Each slice hands its accounts to their shards, in file order */
+    size_t numShards = _shards.size();
+    std::vector<std::vector<std::vector<Account*>>> buckets(chunks.size(), std::vector<std::vector<Account*>>(numShards));
+    runEach(chunks.size(), [&](size_t w) {
+        for(Account& acct : chunks[w].accounts) {
+            buckets[w][&shardFor(acct.getUsername()) - _shards.data()].push_back(&acct);
+        }
+    });
+
+    /* A stable sort keeps the first of repeated accounts first, as inserting
+     * in file order would */
+    runEach(numShards, [&](size_t i) {
+        std::vector<Account> accts;
+        for(size_t w = 0; w < chunks.size(); w++) {
+            for(Account* acct : buckets[w][i]) accts.push_back(std::move(*acct));
+        }
+        std::stable_sort(accts.begin(), accts.end(), [](const Account& a, const Account& b) {
+            int cmp = a.getUsername().compare(b.getUsername());
+            return cmp < 0 || (cmp == 0 && a.getDiscriminator() < b.getDiscriminator());
+        });
+        std::lock_guard<std::mutex> lock(_shards[i].lock);
+        _shards[i].tree.loadAccounts(accts, true);
+    });
+}
+
+void ShardedUTree::clear() {
+    for(Shard& shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        shard.tree.clear();
+    }
+}
+
+void ShardedUTree::setBalance(const BalancePolicy& balance) {
+    for(Shard& shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        shard.tree.setBalance(balance);
+    }
+}
+
+void ShardedUTree::setCompaction(const CompactPolicy& compaction) {
+    for(Shard& shard : _shards) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        shard.tree.setCompaction(compaction);
+    }
+}
+
+void ShardedUTree::printUsers() const {
+    merged([](UNode* node) {node->_dtree->printAccounts();});
+}
+
+/**
+ * Prints each username as username:height:numUsers in username order.
+ * Heights are within the username's own shard.
+ */
+void ShardedUTree::dump() const {
+    merged([](UNode* node) {
+        cout << "(" << node->getUsername() << ":" << node->getHeight() << ":" << node->getDTree()->getNumUsers() << ")";
+    });
+}
+
+/**
+ * Calls visit on every UNode of every shard in username order, merged from
+ * the shards' in-order walks. Holds every shard lock until it is done.
+ */
+void ShardedUTree::merged(const std::function<void(UNode*)>& visit) const {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    std::vector<std::vector<UNode*>> walks(_shards.size());
+    for(size_t i = 0; i < _shards.size(); i++) {
+        locks.emplace_back(_shards[i].lock);
+        collect(_shards[i].tree._root, walks[i]);
+    }
+
+    /* (shard, position) pairs, smallest username on top */
+    using Cursor = std::pair<size_t, size_t>;
+    auto greater = [&walks](const Cursor& a, const Cursor& b) {
+        return walks[a.first][a.second]->getUsername() > walks[b.first][b.second]->getUsername();
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(greater);
+    for(size_t i = 0; i < walks.size(); i++) {
+        if(!walks[i].empty()) heap.push(Cursor(i, 0));
+    }
+
+    while(!heap.empty()) {
+        Cursor top = heap.top();
+        heap.pop();
+        visit(walks[top.first][top.second]);
+        if(++top.second < walks[top.first].size()) heap.push(top);
+    }
+}
+
+void ShardedUTree::collect(UNode* node, std::vector<UNode*>& nodes) {
+    if(node == nullptr) return;
+    collect(node->_left, nodes);
+    nodes.push_back(node);
+    collect(node->_right, nodes);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "utree.h"
+#include "cacheline.h"
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+
+/**
+ * UTree split into independent shards so writers on different usernames
+ * don't serialize on one AVL root. Every username lives in exactly one
+ * shard, picked by hashing it, and each shard has its own lock. Point
+ * operations lock one shard; ordered output locks all of them and merges
+ * the shards' in-order walks by username.
+ */
+class ShardedUTree {
+    friend class Grader;
+    friend class Tester;
+
+public:
+    /* numShards of 0 uses one shard per hardware thread */
+    ShardedUTree(int numShards = 0);
+
+    ShardedUTree(const ShardedUTree&) = delete;
+    ShardedUTree& operator=(const ShardedUTree&) = delete;
+
+    /* Point operations, routed to the username's shard */
+    bool insert(Account newAcct);
+    bool removeUser(std::string_view username, int disc);
+    bool retrieveUser(std::string_view username, int disc, Account& found) const;
+    int numUsers(std::string_view username) const;
+
+    /* Whole tree operations, in username order across every shard */
+    void loadData(string infile);
+    void clear();
+    void setBalance(const BalancePolicy& balance);
+    void setCompaction(const CompactPolicy& compaction);
+    void printUsers() const;
+    void dump() const;
+
+    int numShards() const {return _shards.size();}
+
+private:
+    struct alignas(CACHE_LINE) Shard {
+        UTree tree;
+        mutable std::mutex lock;
+    };
+
+    std::vector<Shard> _shards;
+
+    Shard& shardFor(std::string_view username);
+    const Shard& shardFor(std::string_view username) const;
+    void merged(const std::function<void(UNode*)>& visit) const;
+    static void collect(UNode* node, std::vector<UNode*>& nodes);
+};
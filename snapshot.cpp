@@ -0,0 +1,348 @@
+#include "snapshot.h"
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#define CORRUPT_SNAPSHOT "Corrupt snapshot detected - the file does not match the snapshot layout"
+
+static size_t padded(size_t bytes) {return (bytes + 7) & ~size_t(7);}
+
+/**
+ * Chained 64-bit hash of a section, one 8-byte word at a time.
+ */
+uint64_t Snapshot::checksum(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for(size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+/**
+ * Collects the records and string pool of a UTree while it is saved.
+ */
+struct Snapshot::Builder {
+    std::vector<SnapUNode> unodes;
+    std::vector<SnapDNode> dnodes;
+    std::vector<uint32_t> offsets;
+    string chars;
+    std::unordered_map<std::string_view, uint32_t> pooled;
+
+    Builder() {
+        offsets.push_back(0);
+        intern("");
+    }
+
+    /* Index of str in the pool, adding it the first time it is seen */
+    uint32_t intern(std::string_view str) {
+        auto found = pooled.find(str);
+        if(found != pooled.end()) return found->second;
+        uint32_t index = offsets.size() - 1;
+        chars.append(str);
+        offsets.push_back(chars.size());
+        pooled.emplace(str, index);
+        return index;
+    }
+
+    void addUNode(const UNode* node) {
+        uint32_t at = unodes.size();
+        unodes.push_back(SnapUNode());
+        SnapUNode rec = {};
+        rec.username = intern(node->_username);
+        rec.firstDNode = dnodes.size();
+        rec.height = node->_height;
+        if(node->_dtree->isDense() || node->_dtree->isSmall()) {
+            addUsers(*node->_dtree, rec.firstDNode);
+        } else {
+            addDNode(node->_dtree->_root, rec.firstDNode);
+        }
+        rec.numDNodes = dnodes.size() - rec.firstDNode;
+        if(node->_left != nullptr) {
+            rec.flags |= SNAP_LEFT;
+            addUNode(node->_left);
+        }
+        if(node->_right != nullptr) {
+            rec.flags |= SNAP_RIGHT;
+            rec.right = unodes.size();
+            addUNode(node->_right);
+        }
+        unodes[at] = rec;
+    }
+
+    void addDNode(const DNode* node, uint32_t base) {
+        if(node == nullptr) return;
+        uint32_t at = dnodes.size();
+        dnodes.push_back(SnapDNode());
+        SnapDNode rec = {};
+        rec.badge = intern(node->_account.getBadge());
+        rec.status = intern(node->_account.getStatus());
+        rec.size = node->_size;
+        rec.numVacant = node->_numVacant;
+        rec.disc = node->_account.getDiscriminator();
+        if(node->_vacant) rec.flags |= SNAP_VACANT;
+        if(node->_account.hasNitro()) rec.flags |= SNAP_NITRO;
+        if(node->_left != nullptr) {
+            rec.flags |= SNAP_LEFT;
+            addDNode(node->_left, base);
+        }
+        if(node->_right != nullptr) {
+            rec.flags |= SNAP_RIGHT;
+            rec.right = dnodes.size() - base;
+            addDNode(node->_right, base);
+        }
+        dnodes[at] = rec;
+    }
+
+    /* Dense and small DTrees are stored as the balanced tree of their users, so the
+     * file is searched the same way whichever mode the tree was in */
+    void addUsers(const DTree& dtree, uint32_t base) {
+        std::vector<const DNode*> users;
+        users.reserve(dtree.getNumUsers());
+        dtree.forEachUser([&users](const DNode* node) {users.push_back(node);});
+        addSorted(users, 0, int(users.size()) - 1, base);
+    }
+
+    void addSorted(const std::vector<const DNode*>& users, int first, int last, uint32_t base) {
+        if(first > last) return;
+        int mid = first + (last - first) / 2;
+        const Account& acct = users[mid]->_account;
+        uint32_t at = dnodes.size();
+        dnodes.push_back(SnapDNode());
+        SnapDNode rec = {};
+        rec.badge = intern(acct.getBadge());
+        rec.status = intern(acct.getStatus());
+        rec.size = last - first + 1;
+        rec.disc = acct.getDiscriminator();
+        if(acct.hasNitro()) rec.flags |= SNAP_NITRO;
+        if(mid > first) {
+            rec.flags |= SNAP_LEFT;
+            addSorted(users, first, mid - 1, base);
+        }
+        if(mid < last) {
+            rec.flags |= SNAP_RIGHT;
+            rec.right = dnodes.size() - base;
+            addSorted(users, mid + 1, last, base);
+        }
+        dnodes[at] = rec;
+    }
+};
+
+/**
+ * Writes utree to path in the snapshot layout. The file is written next to
+ * path, synced and then renamed over it, so a crash never leaves half a snapshot.
+ * @return true if the snapshot was written, false otherwise
+ */
+bool Snapshot::save(const UTree& utree, const string& path) {
+    string temp = path + ".tmp";
+    try {
+        FileSink out(temp);
+        write(utree, out);
+        out.sync();
+    } catch(const std::runtime_error&) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    if(std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes utree to sink in the snapshot layout, the header then each section.
+ */
+void Snapshot::write(const UTree& utree, ExportSink& sink) {
+    Builder builder;
+    if(utree._root != nullptr) builder.addUNode(utree._root);
+
+    SnapHeader header = {};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.headerSize = sizeof(SnapHeader);
+    header.numStrings = builder.offsets.size() - 1;
+    header.stringBytes = builder.chars.size();
+    header.numUNodes = builder.unodes.size();
+    header.numDNodes = builder.dnodes.size();
+
+    /* Pad every section out to 8 bytes */
+    if(builder.offsets.size() % 2 != 0) builder.offsets.push_back(0);
+    builder.chars.resize(padded(builder.chars.size()), '\0');
+    const void* sections[] = {builder.offsets.data(), builder.chars.data(), builder.unodes.data(), builder.dnodes.data()};
+    size_t sizes[] = {builder.offsets.size() * sizeof(uint32_t), builder.chars.size(),
+                      builder.unodes.size() * sizeof(SnapUNode), builder.dnodes.size() * sizeof(SnapDNode)};
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < 4; i++) hash = checksum(sections[i], sizes[i], hash);
+    header.checksum = hash;
+
+    sink.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for(int i = 0; i < 4; i++) {
+        sink.write(static_cast<const char*>(sections[i]), sizes[i]);
+    }
+    sink.flush();
+}
+
+/**
+ * Replaces the contents of utree with the snapshot at path.
+ */
+void Snapshot::load(UTree& utree, const string& path) {
+    SnapshotView view(path);
+    utree.clear();
+    if(view._header->numUNodes > 0) {
+        utree._root = restoreUNode(utree, view, 0);
+    }
+}
+
+UNode* Snapshot::restoreUNode(UTree& utree, const SnapshotView& view, uint32_t index) {
+    const SnapUNode& rec = view._unodes[index];
+    DTree* dtree = new DTree(&utree._dnodes, utree._balance, utree._compaction);
+    string username(view.str(rec.username));
+    dtree->_root = restoreDNode(*dtree, view, view._dnodes + rec.firstDNode, 0, username);
+    if(dtree->getNumUsers() >= DENSE_ENTER) {
+        dtree->makeDense();
+    } else if(dtree->getNumUsers() <= SMALL_CUTOFF) {
+        dtree->makeSmall();
+    }
+    UNode* node = utree._unodes.create(dtree);
+    node->_height = rec.height;
+    if(rec.flags & SNAP_LEFT) node->_left = restoreUNode(utree, view, index + 1);
+    if(rec.flags & SNAP_RIGHT) node->_right = restoreUNode(utree, view, rec.right);
+    return node;
+}
+
+DNode* Snapshot::restoreDNode(DTree& dtree, const SnapshotView& view, const SnapDNode* records,
+                              uint32_t index, const string& username) {
+    const SnapDNode& rec = records[index];
+    DNode* node = dtree._pool->create(Account(username, rec.disc, rec.flags & SNAP_NITRO,
+                                              string(view.str(rec.badge)), string(view.str(rec.status))));
+    node->_size = rec.size;
+    node->_numVacant = rec.numVacant;
+    node->_vacant = rec.flags & SNAP_VACANT;
+    if(rec.flags & SNAP_LEFT) node->_left = restoreDNode(dtree, view, records, index + 1, username);
+    if(rec.flags & SNAP_RIGHT) node->_right = restoreDNode(dtree, view, records, rec.right, username);
+    return node;
+}
+
+/**
+ * Maps the snapshot at path and checks its header, checksum and record
+ * links so every later walk stays inside the file.
+ * @param path path to a file written by Snapshot::save
+ */
+SnapshotView::SnapshotView(const string& path): _file(path, false) {
+    /* Check to make sure the file was opened */
+    if(!_file.isOpen()) {
+        std::cerr << __FUNCTION__ << ": File " << path << " could not be opened or located" << endl;
+        exit(-1);
+    }
+    if(_file.size() < sizeof(SnapHeader)) throw std::invalid_argument(CORRUPT_SNAPSHOT);
+    _header = reinterpret_cast<const SnapHeader*>(_file.begin());
+    if(memcmp(_header->magic, SNAPSHOT_MAGIC, sizeof(_header->magic)) != 0
+       || _header->version != SNAPSHOT_VERSION || _header->headerSize != sizeof(SnapHeader)
+       || _header->numStrings == 0 || _header->numStrings > UINT32_MAX || _header->stringBytes > UINT32_MAX
+       || _header->numUNodes > UINT32_MAX || _header->numDNodes > UINT32_MAX) {
+        throw std::invalid_argument(CORRUPT_SNAPSHOT);
+    }
+
+    size_t offsetBytes = padded((_header->numStrings + 1) * sizeof(uint32_t));
+    size_t charBytes = padded(_header->stringBytes);
+    size_t unodeBytes = _header->numUNodes * sizeof(SnapUNode);
+    size_t dnodeBytes = _header->numDNodes * sizeof(SnapDNode);
+    if(_file.size() != sizeof(SnapHeader) + offsetBytes + charBytes + unodeBytes + dnodeBytes) {
+        throw std::invalid_argument(CORRUPT_SNAPSHOT);
+    }
+    const char* body = _file.begin() + sizeof(SnapHeader);
+    if(Snapshot::checksum(body, _file.size() - sizeof(SnapHeader), 0xcbf29ce484222325ULL) != _header->checksum) {
+        throw std::invalid_argument(CORRUPT_SNAPSHOT);
+    }
+    _offsets = reinterpret_cast<const uint32_t*>(body);
+    _chars = body + offsetBytes;
+    _unodes = reinterpret_cast<const SnapUNode*>(_chars + charBytes);
+    _dnodes = reinterpret_cast<const SnapDNode*>(_chars + charBytes + unodeBytes);
+
+    /* Children always come later in preorder, so walks can't loop */
+    for(uint64_t i = 0; i < _header->numStrings; i++) {
+        if(_offsets[i] > _offsets[i + 1]) throw std::invalid_argument(CORRUPT_SNAPSHOT);
+    }
+    if(_offsets[0] != 0 || _offsets[_header->numStrings] != _header->stringBytes) throw std::invalid_argument(CORRUPT_SNAPSHOT);
+    for(uint32_t i = 0; i < _header->numUNodes; i++) {
+        const SnapUNode& rec = _unodes[i];
+        if(rec.username >= _header->numStrings || rec.numDNodes == 0
+           || uint64_t(rec.firstDNode) + rec.numDNodes > _header->numDNodes
+           || ((rec.flags & SNAP_LEFT) && i + 1 >= _header->numUNodes)
+           || ((rec.flags & SNAP_RIGHT) && (rec.right <= i || rec.right >= _header->numUNodes))) {
+            throw std::invalid_argument(CORRUPT_SNAPSHOT);
+        }
+        for(uint32_t j = 0; j < rec.numDNodes; j++) {
+            const SnapDNode& dnode = _dnodes[rec.firstDNode + j];
+            if(dnode.badge >= _header->numStrings || dnode.status >= _header->numStrings
+               || dnode.disc < MIN_DISC || dnode.disc > MAX_DISC
+               || ((dnode.flags & SNAP_LEFT) && j + 1 >= rec.numDNodes)
+               || ((dnode.flags & SNAP_RIGHT) && (dnode.right <= j || dnode.right >= rec.numDNodes))) {
+                throw std::invalid_argument(CORRUPT_SNAPSHOT);
+            }
+        }
+    }
+}
+
+const SnapUNode* SnapshotView::find(std::string_view username) const {
+    if(_header->numUNodes == 0) return nullptr;
+    uint32_t index = 0;
+    while(true) {
+        const SnapUNode& rec = _unodes[index];
+        int cmp = username.compare(str(rec.username));
+        if(cmp == 0) return &rec;
+        if(cmp < 0) {
+            if(!(rec.flags & SNAP_LEFT)) return nullptr;
+            index = index + 1;
+        } else {
+            if(!(rec.flags & SNAP_RIGHT)) return nullptr;
+            index = rec.right;
+        }
+    }
+}
+
+/**
+ * Returns the number of users with a specific username.
+ * @param username username to match
+ * @return number of users with the specified username
+ */
+int SnapshotView::numUsers(std::string_view username) const {
+    const SnapUNode* found = find(username);
+    if(found == nullptr) return 0;
+    const SnapDNode& root = _dnodes[found->firstDNode];
+    return root.size - root.numVacant;
+}
+
+/**
+ * Copies out the account with a matching username and discriminator.
+ * @param username username to match
+ * @param disc discriminator to match
+ * @param found Account object to hold the match
+ * @return true if a matching account exists, false otherwise
+ */
+bool SnapshotView::retrieveUser(std::string_view username, int disc, Account& found) const {
+    const SnapUNode* user = find(username);
+    if(user == nullptr) return false;
+    const SnapDNode* records = _dnodes + user->firstDNode;
+    uint32_t index = 0;
+    while(true) {
+        const SnapDNode& rec = records[index];
+        if(rec.disc == disc) {
+            if(rec.flags & SNAP_VACANT) return false;
+            found = Account(string(username), disc, rec.flags & SNAP_NITRO,
+                            string(str(rec.badge)), string(str(rec.status)));
+            return true;
+        }
+        if(disc < rec.disc) {
+            if(!(rec.flags & SNAP_LEFT)) return false;
+            index = index + 1;
+        } else {
+            if(!(rec.flags & SNAP_RIGHT)) return false;
+            index = rec.right;
+        }
+    }
+}
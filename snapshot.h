@@ -0,0 +1,108 @@
+#pragma once
+
+#include "utree.h"
+#include "mappedfile.h"
+#include "exportsink.h"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#define SNAPSHOT_MAGIC "DTSNAP01"
+#define SNAPSHOT_VERSION 1
+
+/* Flags on SnapUNode/SnapDNode records */
+#define SNAP_LEFT 1
+#define SNAP_RIGHT 2
+#define SNAP_VACANT 4
+#define SNAP_NITRO 8
+
+/*
+ * Snapshot layout, every section padded to 8 bytes:
+ *   SnapHeader
+ *   uint32_t offsets[numStrings + 1]    start of each pooled string
+ *   char chars[stringBytes]             pooled usernames, badges and statuses
+ *   SnapUNode unodes[numUNodes]         UTree in preorder
+ *   SnapDNode dnodes[numDNodes]         each UNode's DTree in preorder, in UNode order
+ * The checksum covers everything after the header. Records store the index
+ * of their right child, so the file can be searched in place.
+ */
+struct SnapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t numStrings;
+    uint64_t stringBytes;
+    uint64_t numUNodes;
+    uint64_t numDNodes;
+    uint64_t checksum;
+};
+
+struct SnapUNode {
+    uint32_t username;      /* string index */
+    uint32_t right;         /* preorder index of the right child */
+    uint32_t firstDNode;    /* first record of this UNode's DTree */
+    uint32_t numDNodes;
+    int32_t height;
+    uint32_t flags;
+};
+
+struct SnapDNode {
+    uint32_t badge;         /* string index */
+    uint32_t status;        /* string index */
+    uint32_t right;         /* index of the right child within this DTree */
+    int32_t size;
+    int32_t numVacant;
+    int16_t disc;
+    uint8_t flags;
+    uint8_t pad;
+};
+
+class SnapshotView;
+
+/**
+ * Writes and restores UTrees in the snapshot layout. Restoring replays the
+ * stored shapes directly, without comparisons or rebalancing.
+ */
+class Snapshot {
+public:
+    static bool save(const UTree& utree, const string& path);
+    static void write(const UTree& utree, ExportSink& sink);
+    static void load(UTree& utree, const string& path);
+
+    /* Hash of a section whose length is a multiple of 8, chained through hash */
+    static uint64_t checksum(const void* data, size_t size, uint64_t hash);
+
+private:
+    struct Builder;
+    static UNode* restoreUNode(UTree& utree, const SnapshotView& view, uint32_t index);
+    static DNode* restoreDNode(DTree& dtree, const SnapshotView& view, const SnapDNode* records,
+                               uint32_t index, const string& username);
+};
+
+/**
+ * Read-only view of a snapshot file, searched in place through the mapping.
+ * Nothing is deserialized, lookups only touch the records on their path.
+ */
+class SnapshotView {
+    friend class Snapshot;
+
+public:
+    SnapshotView(const string& path);
+
+    int numUsers(std::string_view username) const;
+    bool retrieveUser(std::string_view username, int disc, Account& found) const;
+    size_t numUsernames() const {return _header->numUNodes;}
+
+private:
+    MappedFile _file;
+    const SnapHeader* _header;
+    const uint32_t* _offsets;
+    const char* _chars;
+    const SnapUNode* _unodes;
+    const SnapDNode* _dnodes;
+
+    std::string_view str(uint32_t index) const {
+        return std::string_view(_chars + _offsets[index], _offsets[index + 1] - _offsets[index]);
+    }
+    const SnapUNode* find(std::string_view username) const;
+};
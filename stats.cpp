@@ -0,0 +1,150 @@
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+int Histogram::bucketOf(uint64_t value) {
+    if(value < HIST_SUB_BUCKETS) return int(value);
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_BUCKETS + int((value >> shift) - HIST_SUB_BUCKETS);
+}
+
+uint64_t Histogram::bucketLow(int bucket) {
+    if(bucket < HIST_SUB_BUCKETS) return bucket;
+    int shift = bucket / HIST_SUB_BUCKETS - 1;
+    return uint64_t(HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) << shift;
+}
+
+uint64_t Histogram::bucketHigh(int bucket) {
+    if(bucket < HIST_SUB_BUCKETS) return bucket;
+    int shift = bucket / HIST_SUB_BUCKETS - 1;
+    return bucketLow(bucket) + ((uint64_t(1) << shift) - 1);
+}
+
+/**
+ * Walks the buckets until p percent of the values are behind.
+ * @param p percentile between 0 and 100
+ * @return the highest value of that bucket, never more than max
+ */
+uint64_t Histogram::percentile(double p) const {
+    if(count == 0) return 0;
+    uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(count * p / 100)));
+    uint64_t seen = 0;
+    for(int b = 0; b < HIST_BUCKETS; b++) {
+        seen += buckets[b];
+        if(seen >= rank) return std::min(bucketHigh(b), max);
+    }
+    return max;
+}
+
+#ifdef UTREE_STATS
+
+/* Every live thread's counts, and the sum of the threads that exited */
+struct Registry {
+    std::mutex lock;
+    std::vector<ThreadStats*> live;
+    Stats retired = {};
+};
+
+/**
+ * The registry, made on first use since threads can count during static
+ * initialization, and never destroyed since they can count after it too.
+ */
+static Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+static void addTo(Histogram& to, const ThreadStats::Buckets& from) {
+    to.count += from.count.load(std::memory_order_relaxed);
+    to.sum += from.sum.load(std::memory_order_relaxed);
+    to.max = std::max(to.max, from.max.load(std::memory_order_relaxed));
+    for(int b = 0; b < HIST_BUCKETS; b++) to.buckets[b] += from.buckets[b].load(std::memory_order_relaxed);
+}
+
+static void addTo(Stats& to, const ThreadStats& from) {
+    to.rotations += from.rotations.load(std::memory_order_relaxed);
+    to.rebuilds += from.rebuilds.load(std::memory_order_relaxed);
+    addTo(to.rebuildSizes, from.rebuildSizes);
+    to.vacantReclaimed += from.vacantReclaimed.load(std::memory_order_relaxed);
+    to.reclaimedBytes += from.reclaimedBytes.load(std::memory_order_relaxed);
+    to.nodeAllocations += from.nodeAllocations.load(std::memory_order_relaxed);
+    to.utreeLookups += from.utreeLookups.load(std::memory_order_relaxed);
+    to.utreeComparisons += from.utreeComparisons.load(std::memory_order_relaxed);
+    to.dtreeLookups += from.dtreeLookups.load(std::memory_order_relaxed);
+    to.dtreeComparisons += from.dtreeComparisons.load(std::memory_order_relaxed);
+    for(int op = 0; op < STATS_OPS; op++) addTo(to.latency[op], from.latency[op]);
+}
+
+static void clear(ThreadStats::Buckets& buckets) {
+    buckets.count.store(0, std::memory_order_relaxed);
+    buckets.sum.store(0, std::memory_order_relaxed);
+    buckets.max.store(0, std::memory_order_relaxed);
+    for(std::atomic<uint64_t>& bucket : buckets.buckets) bucket.store(0, std::memory_order_relaxed);
+}
+
+static void clear(ThreadStats& stats) {
+    for(std::atomic<uint64_t>* counter : {&stats.rotations, &stats.rebuilds, &stats.vacantReclaimed, &stats.reclaimedBytes,
+                                          &stats.nodeAllocations, &stats.utreeLookups, &stats.utreeComparisons, &stats.dtreeLookups,
+                                          &stats.dtreeComparisons}) {
+        counter->store(0, std::memory_order_relaxed);
+    }
+    clear(stats.rebuildSizes);
+    for(ThreadStats::Buckets& latency : stats.latency) clear(latency);
+}
+
+/**
+ * Folds a thread's counts into retired when the thread exits.
+ */
+struct Detach {
+    ThreadStats* stats;
+    ~Detach() {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> guard(all.lock);
+        addTo(all.retired, *stats);
+        all.live.erase(std::find(all.live.begin(), all.live.end(), stats));
+        delete stats;
+    }
+};
+
+ThreadStats* ThreadStats::attach() {
+    static thread_local Detach detach = {new ThreadStats()};
+    Registry& all = registry();
+    std::lock_guard<std::mutex> guard(all.lock);
+    all.live.push_back(detach.stats);
+    _local = detach.stats;
+    return _local;
+}
+
+bool Stats::enabled() {return true;}
+
+Stats Stats::snapshot() {
+    Registry& all = registry();
+    std::lock_guard<std::mutex> guard(all.lock);
+    Stats total = all.retired;
+    for(ThreadStats* stats : all.live) addTo(total, *stats);
+    return total;
+}
+
+void Stats::reset() {
+    Registry& all = registry();
+    std::lock_guard<std::mutex> guard(all.lock);
+    memset(&all.retired, 0, sizeof(all.retired));
+    for(ThreadStats* stats : all.live) clear(*stats);
+}
+
+#else
+
+bool Stats::enabled() {return false;}
+
+Stats Stats::snapshot() {
+    Stats none;
+    memset(&none, 0, sizeof(none));
+    return none;
+}
+
+void Stats::reset() {}
+
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Counts of the work the trees do and latency histograms of the UTree calls.
+ * Only built in when UTREE_STATS is defined (cmake -DUTREE_STATS=ON), every
+ * STATS_ macro is empty otherwise and Stats::snapshot() returns zeros. Each
+ * thread counts into its own ThreadStats, threads are only summed when a
+ * snapshot is taken.
+ */
+
+/* Timed UTree calls, the index into Stats::latency */
+#define STATS_INSERT 0
+#define STATS_REMOVE 1
+#define STATS_RETRIEVE 2
+#define STATS_RETRIEVE_USER 3
+#define STATS_NUM_USERS 4
+#define STATS_LOAD 5
+#define STATS_OPS 6
+
+/* Histogram layout, every power of two is split into HIST_SUB_BUCKETS
+ * buckets, so a value is known to within 1/HIST_SUB_BUCKETS of itself */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+/**
+ * Log-linear histogram in the style of HdrHistogram. Values below
+ * HIST_SUB_BUCKETS have a bucket each, larger ones share a bucket with the
+ * values that agree with them in their top HIST_SUB_BITS + 1 bits.
+**/
+struct Histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+
+    double mean() const {return count == 0 ? 0 : double(sum) / count;}
+    /* Highest value in the bucket holding the p-th percentile, 0 if empty */
+    uint64_t percentile(double p) const;
+
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketLow(int bucket);
+    static uint64_t bucketHigh(int bucket);
+};
+
+/**
+ * Every thread's counts added up, taken with Stats::snapshot().
+**/
+struct Stats {
+    uint64_t rotations;             /* AVL rotations in UTrees */
+    uint64_t rebuilds;              /* subtrees rebuilt by DTree::rebalance */
+    Histogram rebuildSizes;         /* valid users in each rebuilt subtree */
+    uint64_t vacantReclaimed;       /* vacant nodes dropped by those rebuilds */
+    uint64_t reclaimedBytes;        /* their bytes, strings included */
+    uint64_t nodeAllocations;       /* DNodes and UNodes made by a NodePool */
+    uint64_t utreeLookups;          /* username searches */
+    uint64_t utreeComparisons;      /* UNodes they compared against */
+    uint64_t dtreeLookups;          /* discriminator searches */
+    uint64_t dtreeComparisons;      /* DNodes they compared against, a small
+                                     * tree search counts once, a dense slot
+                                     * not at all */
+    Histogram latency[STATS_OPS];   /* nanoseconds per UTree call */
+
+    double comparisonsPerUTreeLookup() const {return utreeLookups == 0 ? 0 : double(utreeComparisons) / utreeLookups;}
+    double comparisonsPerDTreeLookup() const {return dtreeLookups == 0 ? 0 : double(dtreeComparisons) / dtreeLookups;}
+
+    /* Whether this build counts anything */
+    static bool enabled();
+    /* Counts of every thread so far, including threads that have exited */
+    static Stats snapshot();
+    /* Zeros every count, counts racing with it may survive */
+    static void reset();
+};
+
+#ifdef UTREE_STATS
+
+/* Owner thread only writes, a snapshot may read at the same time, so
+ * relaxed atomics without a read-modify-write are enough */
+inline void statsAdd(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/**
+ * One thread's counts, written only by that thread.
+**/
+struct ThreadStats {
+    struct Buckets {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+        std::atomic<uint64_t> buckets[HIST_BUCKETS] = {};
+
+        void record(uint64_t value) {
+            statsAdd(count, 1);
+            statsAdd(sum, value);
+            if(value > max.load(std::memory_order_relaxed)) max.store(value, std::memory_order_relaxed);
+            statsAdd(buckets[Histogram::bucketOf(value)], 1);
+        }
+    };
+
+    std::atomic<uint64_t> rotations{0};
+    std::atomic<uint64_t> rebuilds{0};
+    Buckets rebuildSizes;
+    std::atomic<uint64_t> vacantReclaimed{0};
+    std::atomic<uint64_t> reclaimedBytes{0};
+    std::atomic<uint64_t> nodeAllocations{0};
+    std::atomic<uint64_t> utreeLookups{0};
+    std::atomic<uint64_t> utreeComparisons{0};
+    std::atomic<uint64_t> dtreeLookups{0};
+    std::atomic<uint64_t> dtreeComparisons{0};
+    Buckets latency[STATS_OPS];
+
+    /* The calling thread's counts, registered on first use */
+    static ThreadStats* local() {
+        ThreadStats* stats = _local;
+        return stats != nullptr ? stats : attach();
+    }
+
+private:
+    static inline thread_local ThreadStats* _local = nullptr;
+    static ThreadStats* attach();
+};
+
+/**
+ * Times a UTree call from construction to the end of its scope.
+**/
+class StatsTimer {
+public:
+    StatsTimer(int op): _op(op), _start(std::chrono::steady_clock::now()) {}
+    ~StatsTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - _start;
+        ThreadStats::local()->latency[_op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    StatsTimer(const StatsTimer&) = delete;
+    StatsTimer& operator=(const StatsTimer&) = delete;
+
+private:
+    int _op;
+    std::chrono::steady_clock::time_point _start;
+};
+
+#define STATS_ADD(counter, n) statsAdd(ThreadStats::local()->counter, n)
+#define STATS_RECORD(histogram, value) ThreadStats::local()->histogram.record(value)
+#define STATS_TIME(op) StatsTimer statsTimer(op)
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_RECORD(histogram, value) ((void)0)
+#define STATS_TIME(op) ((void)0)
+
+#endif
+
+#define STATS_COUNT(counter) STATS_ADD(counter, 1)
@@ -0,0 +1,196 @@
+#include "trace.h"
+#include "mappedfile.h"
+#include <cstring>
+#include <stdexcept>
+
+#define MAGIC_LENGTH 8
+#define NOT_A_TRACE "Not a trace - the file does not start with the trace header"
+
+/**
+ * Reads the fields of a trace in order, ok turns false at a record that is
+ * cut short.
+ */
+struct TraceReader {
+    const char* pos;
+    const char* end;
+    bool ok = true;
+
+    bool flag() {
+        if(pos == end) {ok = false; return false;}
+        return *pos++ != 0;
+    }
+    uint64_t varint() {
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7) {
+            if(pos == end) break;
+            unsigned char byte = *pos++;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if(!(byte & 0x80)) return value;
+        }
+        ok = false;
+        return 0;
+    }
+    int disc() {
+        uint64_t value = varint();
+        return int(value >> 1) ^ -int(value & 1);
+    }
+    string str() {
+        uint64_t length = varint();
+        if(!ok || uint64_t(end - pos) < length) {ok = false; return string();}
+        string value(pos, length);
+        pos += length;
+        return value;
+    }
+};
+
+TraceRecorder::TraceRecorder(const string& path): _sink(path), _start(std::chrono::steady_clock::now()), _last(0) {
+    _sink.write(TRACE_MAGIC, MAGIC_LENGTH);
+}
+
+void TraceRecorder::logInsert(const Account& acct) {
+    std::lock_guard<std::mutex> guard(_lock);
+    beginRecord(TRACE_INSERT);
+    appendString(acct.getUsername());
+    appendDisc(acct.getDiscriminator());
+    _record.push_back(acct.hasNitro());
+    appendString(acct.getBadge());
+    appendString(acct.getStatus());
+    endRecord();
+}
+
+void TraceRecorder::logRemove(std::string_view username, int disc) {
+    std::lock_guard<std::mutex> guard(_lock);
+    beginRecord(TRACE_REMOVE);
+    appendString(username);
+    appendDisc(disc);
+    endRecord();
+}
+
+void TraceRecorder::logRetrieve(std::string_view username) {
+    std::lock_guard<std::mutex> guard(_lock);
+    beginRecord(TRACE_RETRIEVE);
+    appendString(username);
+    endRecord();
+}
+
+void TraceRecorder::logRetrieveUser(std::string_view username, int disc) {
+    std::lock_guard<std::mutex> guard(_lock);
+    beginRecord(TRACE_RETRIEVE_USER);
+    appendString(username);
+    appendDisc(disc);
+    endRecord();
+}
+
+void TraceRecorder::logNumUsers(std::string_view username) {
+    std::lock_guard<std::mutex> guard(_lock);
+    beginRecord(TRACE_NUM_USERS);
+    appendString(username);
+    endRecord();
+}
+
+void TraceRecorder::logLoad(std::string_view path, bool append) {
+    std::lock_guard<std::mutex> guard(_lock);
+    beginRecord(TRACE_LOAD);
+    appendString(path);
+    _record.push_back(append);
+    endRecord();
+}
+
+void TraceRecorder::flush() {
+    std::lock_guard<std::mutex> guard(_lock);
+    _sink.flush();
+}
+
+/**
+ * Starts a record, the clock is read under the lock so times never go
+ * backwards between records.
+ */
+void TraceRecorder::beginRecord(int type) {
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+    _record.clear();
+    _record.push_back(char(type));
+    appendVarint(now - _last);
+    _last = now;
+}
+
+void TraceRecorder::endRecord() {
+    _sink.write(_record.data(), _record.size());
+}
+
+void TraceRecorder::appendVarint(uint64_t value) {
+    while(value >= 0x80) {
+        _record.push_back(char(value | 0x80));
+        value >>= 7;
+    }
+    _record.push_back(char(value));
+}
+
+void TraceRecorder::appendDisc(int disc) {
+    appendVarint((uint32_t(disc) << 1) ^ uint32_t(disc >> 31));
+}
+
+void TraceRecorder::appendString(std::string_view str) {
+    appendVarint(str.size());
+    _record.append(str);
+}
+
+/**
+ * Reads every complete record of the trace at path.
+ * @return the recorded calls in order
+ */
+std::vector<TraceOp> TraceRecorder::load(const string& path) {
+    MappedFile file(path);
+    if(file.size() < MAGIC_LENGTH || memcmp(file.begin(), TRACE_MAGIC, MAGIC_LENGTH) != 0) {
+        throw std::invalid_argument(NOT_A_TRACE);
+    }
+    std::vector<TraceOp> ops;
+    TraceReader reader = {file.begin() + MAGIC_LENGTH, file.end()};
+    uint64_t time = 0;
+    while(reader.pos < reader.end) {
+        TraceOp op = {*reader.pos++, 0, "", INVALID_DISC, false, "", "", false};
+        time += reader.varint();
+        op.time = time;
+        op.username = reader.str();
+        if(op.type == TRACE_INSERT || op.type == TRACE_REMOVE || op.type == TRACE_RETRIEVE_USER) {
+            op.disc = reader.disc();
+        }
+        if(op.type == TRACE_INSERT) {
+            op.nitro = reader.flag();
+            op.badge = reader.str();
+            op.status = reader.str();
+        }
+        if(op.type == TRACE_LOAD) {
+            op.append = reader.flag();
+        }
+        if(!reader.ok || op.type < TRACE_INSERT || op.type > TRACE_LOAD) break;
+        ops.push_back(std::move(op));
+    }
+    return ops;
+}
+
+/**
+ * Makes the recorded call on utree.
+ */
+void TraceRecorder::apply(const TraceOp& op, UTree& utree) {
+    DNode* removed;
+    switch(op.type) {
+    case TRACE_INSERT:
+        utree.insert(Account(op.username, op.disc, op.nitro, op.badge, op.status));
+        break;
+    case TRACE_REMOVE:
+        utree.removeUser(op.username, op.disc, removed);
+        break;
+    case TRACE_RETRIEVE:
+        utree.retrieve(op.username);
+        break;
+    case TRACE_RETRIEVE_USER:
+        utree.retrieveUser(op.username, op.disc);
+        break;
+    case TRACE_NUM_USERS:
+        utree.numUsers(op.username);
+        break;
+    case TRACE_LOAD:
+        utree.loadData(op.username, op.append);
+        break;
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "utree.h"
+#include "exportsink.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#define TRACE_MAGIC "DTTRACE1"
+
+/* Trace record types */
+#define TRACE_INSERT 1
+#define TRACE_REMOVE 2
+#define TRACE_RETRIEVE 3
+#define TRACE_RETRIEVE_USER 4
+#define TRACE_NUM_USERS 5
+#define TRACE_LOAD 6
+
+/*
+ * Trace layout: the 8 byte magic, then one record per call
+ *   uint8_t type
+ *   varint time                    nanoseconds since the previous record
+ *   fields                         by type, strings as a varint length and
+ *                                  their bytes, discriminators as varints
+ *                                  (zigzag, so INVALID_DISC stays short)
+ *     insert                       username, disc, nitro byte, badge, status
+ *     remove, retrieve user        username, disc
+ *     retrieve, num users          username
+ *     load                         file path, append byte
+ * A record cut short by a crash ends the trace.
+ */
+
+/* One recorded call, time counts from the start of the trace */
+struct TraceOp {
+    int type;
+    uint64_t time;
+    string username;        /* the file path of a load */
+    int disc;
+    bool nitro;
+    string badge;
+    string status;
+    bool append;            /* of a load */
+};
+
+/**
+ * Records the public operations of a UTree to a trace file, so production
+ * traffic can be replayed offline against another build. Attach it with
+ * UTree::setTracer. Records are buffered in a FileSink and written under a
+ * lock, so readers on several threads can share one recorder.
+ */
+class TraceRecorder {
+public:
+    /* Creates or truncates path, throws std::runtime_error if it can't */
+    TraceRecorder(const string& path);
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    /* Called by UTree as each operation starts */
+    void logInsert(const Account& acct);
+    void logRemove(std::string_view username, int disc);
+    void logRetrieve(std::string_view username);
+    void logRetrieveUser(std::string_view username, int disc);
+    void logNumUsers(std::string_view username);
+    void logLoad(std::string_view path, bool append);
+
+    /* Writes out every buffered record */
+    void flush();
+
+    /* Every complete record of a trace file, throws std::invalid_argument
+     * if it isn't a trace */
+    static std::vector<TraceOp> load(const string& path);
+    /* Runs one recorded call against utree */
+    static void apply(const TraceOp& op, UTree& utree);
+
+private:
+    FileSink _sink;
+    std::mutex _lock;
+    std::chrono::steady_clock::time_point _start;
+    uint64_t _last;         /* time of the previous record */
+    string _record;         /* record being built, under _lock */
+
+    void beginRecord(int type);
+    void endRecord();
+    void appendVarint(uint64_t value);
+    void appendDisc(int disc);
+    void appendString(std::string_view str);
+};
@@ -1,5 +1,99 @@
 
 #include "utree.h"
+#include "mappedfile.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "frozenutree.h"
+#include "exportsink.h"
+#include "trace.h"
+#include "stats.h"
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define NUM_FIELDS 5
+#define MALFORMED_LINE "Malformed input file detected - ensure each line contains 5 fields deliminated by a ','"
+
+/**
+ * Returns the first ',' or '\n' in [pos, end), or end if there is none.
+ * Scans 16 bytes at a time where SSE2 is available.
+ */
+static const char* findDelim(const char* pos, const char* end) {
+#ifdef __SSE2__
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while(end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma),
+                                                  _mm_cmpeq_epi8(chunk, newline)));
+        if(mask != 0) return pos + __builtin_ctz(mask);
+        pos += 16;
+    }
+#endif
+    while(pos < end && *pos != ',' && *pos != '\n') pos++;
+    return pos;
+}
+
+/**
+ * Orders accounts by (username, discriminator).
+ */
+static bool accountLess(const Account& a, const Account& b) {
+    int cmp = a.getUsername().compare(b.getUsername());
+    return cmp < 0 || (cmp == 0 && a.getDiscriminator() < b.getDiscriminator());
+}
+
+/**
+ * Parses an integer field in place.
+ */
+static int parseInt(const char* first, const char* last) {
+    int value = 0;
+    std::from_chars_result result = std::from_chars(first, last, value);
+    if(result.ec == std::errc::result_out_of_range) {
+        throw std::out_of_range("Integer field out of range");
+    }
+    if(result.ec != std::errc()) {
+        throw std::invalid_argument("Integer field expected");
+    }
+    return value;
+}
+
+/**
+ * Parses the line starting at pos into an Account and moves pos past its '\n'.
+ * Throws the same malformed-line error as loadData.
+ */
+static Account parseLine(const char*& pos, const char* end) {
+    const char* fields[NUM_FIELDS + 1];
+    int delimCount = 0;
+    fields[0] = pos;
+    const char* delim = findDelim(pos, end);
+    while(delim != end && *delim == ',') {
+        if(++delimCount >= NUM_FIELDS) {
+            throw std::invalid_argument(MALFORMED_LINE);
+        }
+        fields[delimCount] = delim + 1;
+        delim = findDelim(delim + 1, end);
+    }
+    if(delimCount != NUM_FIELDS - 1) {
+        throw std::invalid_argument(MALFORMED_LINE);
+    }
+    fields[NUM_FIELDS] = delim + 1;
+    pos = (delim == end ? end : delim + 1);
+
+    /* Strings are built straight into the Account, nothing else is allocated */
+    return Account(string(fields[0], fields[1] - 1),
+                   parseInt(fields[1], fields[2] - 1),
+                   parseInt(fields[2], fields[3] - 1),
+                   string(fields[3], fields[4] - 1),
+                   string(fields[4], fields[5] - 1));
+}
 
 /**
  * Destructor, deletes all dynamic memory.
@@ -14,10 +108,12 @@ UTree::~UTree() {
  * @param append true to append to an existing tree structure or false to clear before importing
  */ 
 void UTree::loadData(string infile, bool append) {
+    STATS_TIME(STATS_LOAD);
+    if(_tracer != nullptr) _tracer->logLoad(infile, append);
     std::ifstream instream(infile);
     string line;
     char delim = ',';
-    const int numFields = 5;
+    const int numFields = NUM_FIELDS;
     string fields[numFields];
 
     /* Check to make sure the file was opened */
@@ -29,26 +125,315 @@ void UTree::loadData(string infile, bool append) {
     /* Should we append or clear? */
     if(!append) this->clear();
 
-    /* Read in the data from the .csv file and insert into the UTree */
-    while(std::getline(instream, line)) {
-        std::stringstream buffer(line);
+    /* Read in the data from the .csv file. Sorted input going into an empty
+     * tree is bulk built, anything else is inserted line by line */
+    std::vector<Account> accts;
+    bool sorted = true;
+    try {
+        while(std::getline(instream, line)) {
+            /* Quick check to make sure each line is formatted correctly */
+            int delimCount = 0;
+            for(unsigned int c = 0; c < line.length(); c++) if(line[c] == delim) delimCount++;
+            if(delimCount != numFields - 1) {
+                throw std::invalid_argument(MALFORMED_LINE);
+            }
+            std::stringstream buffer(line);
+
+            /* Populate the account attributes - 
+             * Each line always has 5 sections of data */
+            for(int i = 0; i < numFields; i++) {
+                std::getline(buffer, line, delim);
+                fields[i] = line;
+            }
+            accts.push_back(Account(fields[0], std::stoi(fields[1]), std::stoi(fields[2]), fields[3], fields[4]));
+            if(accts.size() > 1 && accountLess(accts.back(), accts[accts.size() - 2])) sorted = false;
+        }
+    } catch(...) {
+        /* Every line before the bad one still goes in */
+        loadAccounts(accts, sorted);
+        throw;
+    }
+    loadAccounts(accts, sorted);
+}
+
+/**
+ * Same as loadData, but maps the file into memory and parses each line in
+ * place instead of going through a stringstream.
+ * @param infile path to .csv file containing database of accounts
+ * @param append true to append to an existing tree structure or false to clear before importing
+ */
+void UTree::loadMapped(string infile, bool append) {
+    MappedFile file(infile);
+
+    /* Check to make sure the file was opened */
+    if(!file.isOpen()) {
+        std::cerr << __FUNCTION__ << ": File " << infile << " could not be opened or located" << endl;
+        exit(-1);
+    }
+
+    /* Should we append or clear? */
+    if(!append) this->clear();
+
+    std::vector<Account> accts;
+    bool sorted = true;
+    try {
+        const char* pos = file.begin();
+        while(pos < file.end()) {
+            accts.push_back(parseLine(pos, file.end()));
+            if(accts.size() > 1 && accountLess(accts.back(), accts[accts.size() - 2])) sorted = false;
+        }
+    } catch(...) {
+        loadAccounts(accts, sorted);
+        throw;
+    }
+    loadAccounts(accts, sorted);
+}
+
+/**
+ * Helper for the loaders.
+ * Bulk builds the tree when it is empty and the accounts came in sorted,
+ * otherwise inserts them one at a time in file order.
+ */
+void UTree::loadAccounts(std::vector<Account>& accts, bool sorted) {
+    if(sorted && _root == nullptr) {
+        buildFromSorted(std::move(accts));
+    } else {
+        for(Account& acct : accts) insert(acct, _root);
+    }
+    accts.clear();
+}
+
+/**
+ * Every account for one username within a partition, in file order. tree is
+ * built by the worker when the username is not in the UTree yet.
+ */
+struct UserGroup {
+    Account** first;
+    int count;
+    DTree* tree;
+};
+
+/**
+ * Runs work(0) .. work(threads - 1), each on its own thread.
+ */
+template <class Work>
+static void runWorkers(int threads, Work work) {
+    std::vector<std::thread> workers;
+    for(int w = 1; w < threads; w++) workers.emplace_back(work, w);
+    work(0);
+    for(std::thread& worker : workers) worker.join();
+}
+
+/**
+ * Helper for the parallel loaders.
+ * Cuts [begin, end) into one slice per thread, each ending on a '\n', and
+ * parses the slices in parallel. A slice stops at its first malformed line.
+ * @param threads number of slices, at least 1
+ * @return the accounts of every slice, in file order
+ */
+std::vector<UTree::ParsedChunk> UTree::parseSlices(const char* begin, const char* end, int threads) {
+    std::vector<const char*> bounds(threads + 1);
+    size_t size = end - begin;
+    bounds[0] = begin;
+    bounds[threads] = end;
+    for(int i = 1; i < threads; i++) {
+        const char* cut = std::max(begin + size * i / threads, bounds[i - 1]);
+        cut = static_cast<const char*>(memchr(cut, '\n', end - cut));
+        bounds[i] = (cut == nullptr ? end : cut + 1);
+    }
+
+    std::vector<ParsedChunk> chunks(threads);
+    runWorkers(threads, [&](int w) {
+        try {
+            std::vector<Account>& accts = chunks[w].accounts;
+            const char* pos = bounds[w];
+            while(pos < bounds[w + 1]) {
+                accts.push_back(parseLine(pos, bounds[w + 1]));
+                if(accts.size() > 1 && accountLess(accts.back(), accts[accts.size() - 2])) chunks[w].sorted = false;
+            }
+        } catch(...) {
+            chunks[w].error = std::current_exception();
+        }
+    });
+    return chunks;
+}
+
+/**
+ * Multi-threaded version of loadMapped. The file is split at line boundaries
+ * and parsed in parallel, the accounts are range partitioned by username and
+ * each worker builds the DTrees for its own usernames. Every DTree sees its
+ * accounts in file order, so the accounts stored are identical to loadData.
+ * A malformed line leaves the tree holding every line before it, as in loadData.
+ * @param infile path to .csv file containing database of accounts
+ * @param append true to append to an existing tree structure or false to clear before importing
+ * @param threads number of workers, 0 to use every hardware thread
+ */
+void UTree::loadParallel(string infile, bool append, int threads) {
+    MappedFile file(infile);
+
+    /* Check to make sure the file was opened */
+    if(!file.isOpen()) {
+        std::cerr << __FUNCTION__ << ": File " << infile << " could not be opened or located" << endl;
+        exit(-1);
+    }
+
+    /* Should we append or clear? */
+    if(!append) this->clear();
+    bool wasEmpty = (_root == nullptr);
+
+    if(file.begin() == file.end()) return;
+    if(threads <= 0) threads = std::thread::hardware_concurrency();
+    if(threads <= 0) threads = 1;
+
+    /* Parse every slice */
+    std::vector<ParsedChunk> chunks = parseSlices(file.begin(), file.end(), threads);
+    for(int w = 0; w < threads; w++) {
+        if(chunks[w].error) {
+            for(int i = 0; i <= w; i++) {
+                for(Account& acct : chunks[i].accounts) insert(acct, _root);
+            }
+            std::rethrow_exception(chunks[w].error);
+        }
+    }
+
+    /* Sorted input into an empty tree is bulk built, as in loadData */
+    bool sorted = wasEmpty;
+    const Account* last = nullptr;
+    for(ParsedChunk& chunk : chunks) {
+        if(chunk.accounts.empty()) continue;
+        if(!chunk.sorted || (last != nullptr && accountLess(chunk.accounts.front(), *last))) sorted = false;
+        last = &chunk.accounts.back();
+    }
+
+    /* Pick username splitters from a sample so the partitions come out even */
+    std::vector<const string*> samples;
+    for(ParsedChunk& chunk : chunks) {
+        size_t step = std::max<size_t>(1, chunk.accounts.size() / 64);
+        for(size_t i = 0; i < chunk.accounts.size(); i += step) samples.push_back(&chunk.accounts[i].getUsername());
+    }
+    std::sort(samples.begin(), samples.end(), [](const string* a, const string* b) {return *a < *b;});
+    std::vector<string> splitters;
+    for(int i = 1; i < threads && !samples.empty(); i++) splitters.push_back(*samples[samples.size() * i / threads]);
+    int parts = splitters.size() + 1;
+
+    /* Every slice sorts its accounts into the partitions, keeping file order */
+    std::vector<std::vector<std::vector<Account*>>> buckets(threads, std::vector<std::vector<Account*>>(parts));
+    runWorkers(threads, [&](int w) {
+        for(Account& acct : chunks[w].accounts) {
+            int part = std::upper_bound(splitters.begin(), splitters.end(), acct.getUsername()) - splitters.begin();
+            buckets[w][part].push_back(&acct);
+        }
+    });
 
-        /* Quick check to make sure each line is formatted correctly */
-        int delimCount = 0;
-        for(unsigned int c = 0; c < buffer.str().length(); c++) if(buffer.str()[c] == delim) delimCount++;
-        if(delimCount != numFields - 1) {
-            throw std::invalid_argument("Malformed input file detected - ensure each line contains 5 fields deliminated by a ','");
+    /* Each partition groups its usernames and builds their DTrees in its own pool */
+    std::unique_ptr<NodePool<DNode>[]> pools(new NodePool<DNode>[parts]);
+    std::vector<std::vector<Account*>> partAccts(parts);
+    std::vector<std::vector<UserGroup>> groups(parts);
+    runWorkers(parts, [&](int p) {
+        std::vector<Account*>& accts = partAccts[p];
+        for(int w = 0; w < threads; w++) accts.insert(accts.end(), buckets[w][p].begin(), buckets[w][p].end());
+        std::stable_sort(accts.begin(), accts.end(), [](const Account* a, const Account* b) {
+            return a->getUsername() < b->getUsername();
+        });
+        for(size_t i = 0; i < accts.size();) {
+            size_t j = i + 1;
+            while(j < accts.size() && accts[j]->getUsername() == accts[i]->getUsername()) j++;
+            UserGroup group = {&accts[i], int(j - i), nullptr};
+            if(sorted) {
+                std::vector<Account> run;
+                run.reserve(group.count);
+                for(int k = 0; k < group.count; k++) run.push_back(std::move(*group.first[k]));
+                group.tree = new DTree(&pools[p], _balance, _compaction);
+                group.tree->buildFromSorted(run.data(), group.count);
+            } else if(retrieve(accts[i]->getUsername(), _root) == nullptr) {
+                group.tree = new DTree(&pools[p], _balance, _compaction);
+                for(int k = 0; k < group.count; k++) group.tree->insert(std::move(*group.first[k]));
+            }
+            groups[p].push_back(group);
+            i = j;
         }
+    });
 
-        /* Populate the account attributes - 
-         * Each line always has 5 sections of data */
-        for(int i = 0; i < numFields; i++) {
-            std::getline(buffer, line, delim);
-            fields[i] = line;
+    /* Hand the finished DTrees to this tree */
+    std::vector<UNode*> nodes;
+    for(int p = 0; p < parts; p++) {
+        _dnodes.adopt(pools[p]);
+        for(UserGroup& group : groups[p]) {
+            if(group.tree != nullptr) {
+                group.tree->_pool = &_dnodes;
+            }
+            if(sorted) {
+                nodes.push_back(_unodes.create(group.tree));
+            } else if(group.tree != nullptr) {
+                insertDTree(group.tree, _root);
+            } else {
+                for(int k = 0; k < group.count; k++) insert(*group.first[k], _root);
+            }
         }
-        Account newAcct = Account(fields[0], std::stoi(fields[1]), std::stoi(fields[2]), fields[3], fields[4]);
-        this->insert(newAcct);
     }
+    if(sorted) {
+        _root = fillTree(nodes.data(), 0, int(nodes.size()) - 1);
+    }
+}
+
+/**
+ * Writes the whole tree to a binary snapshot (see snapshot.h).
+ * @param path file to write, replaced atomically
+ * @return true if the snapshot was written, false otherwise
+ */
+bool UTree::saveSnapshot(string path) const {
+    return Snapshot::save(*this, path);
+}
+
+/**
+ * Replaces the contents of the tree with a snapshot written by saveSnapshot.
+ * The stored tree shapes are restored as they were, without any comparisons
+ * or rebalancing.
+ * @param path snapshot file to read
+ */
+void UTree::loadSnapshot(string path) {
+    Snapshot::load(*this, path);
+}
+
+/**
+ * Replaces the contents of the tree with perfectly balanced trees built in
+ * O(n) from accounts sorted by (username, discriminator). Repeated accounts
+ * keep the first one, as repeated inserts would.
+ * @param sorted Accounts in ascending (username, discriminator) order
+ */
+void UTree::buildFromSorted(std::vector<Account> sorted) {
+  for(size_t i = 1; i < sorted.size(); i++){
+    if(accountLess(sorted[i], sorted[i-1])){
+      throw std::invalid_argument("buildFromSorted: accounts are not sorted by username and discriminator");
+    }
+  }
+  clear();
+  std::vector<UNode*> nodes;
+  for(size_t i = 0; i < sorted.size();){
+    size_t j = i + 1;
+    while(j < sorted.size() && sorted[j].getUsername() == sorted[i].getUsername()) j++;
+    DTree* dtree = new DTree(&_dnodes, _balance, _compaction);
+    dtree->buildFromSorted(&sorted[i], j - i);
+    nodes.push_back(_unodes.create(dtree));
+    i = j;
+  }
+  _root = fillTree(nodes.data(), 0, int(nodes.size()) - 1);
+}
+
+/**
+ * Helper function for buildFromSorted.
+ * Links nodes[first..last] into a perfectly balanced subtree and returns its root.
+ */
+UNode* UTree::fillTree(UNode** nodes, int first, int last) {
+  if(first > last){
+    return nullptr;
+  }
+  int mid = first + (last - first)/2;
+  UNode* node = nodes[mid];
+  node->_left = fillTree(nodes, first, mid - 1);
+  node->_right = fillTree(nodes, mid + 1, last);
+  updateHeight(node);
+  return node;
 }
 
 /**
@@ -59,30 +444,50 @@ void UTree::loadData(string infile, bool append) {
  * @return true if the account was inserted, false otherwise
  */
 bool UTree::insert(Account newAcct) {
-  int success = insert(newAcct, _root);
+  STATS_TIME(STATS_INSERT);
+  if(_tracer != nullptr){
+    _tracer->logInsert(newAcct);
+  }
+  if(_journal != nullptr){
+    _journal->logInsert(newAcct);
+  }
+  int success;
+  try{
+    success = insert(newAcct, _root);
+  }catch(...){
+    //the record of an insert that threw is never written
+    if(_journal != nullptr){
+      _journal->commit(false);
+    }
+    throw;
+  }
+  if(_journal != nullptr){
+    _journal->commit(success);
+  }
   return success;
 }
 
 
-bool UTree::insert(Account newAcct, UNode *&node) {
+bool UTree::insert(Account& newAcct, UNode *&node) {
   if(node == nullptr){
-    DTree *newDTree = new DTree();
-    if(newDTree->insert(newAcct)){ //if Account doesn't already exist, create 
-      UNode *newNode = new UNode();
+    DTree *newDTree = new DTree(&_dnodes, _balance, _compaction);
+    if(newDTree->insert(std::move(newAcct))){ //if Account doesn't already exist, create 
+      UNode *newNode = _unodes.create(newDTree);
       node = newNode;
-      node->_dtree = newDTree;
       updateHeight(node);
       rebalance(node);
       return true;
     }else{
+      delete newDTree;
       return false;}
   }
-  if(newAcct.getUsername() == node->getUsername()){
+  int cmp = newAcct.getUsername().compare(node->_username);
+  if(cmp == 0){
     //insert account into dtree if username is the same
-    int success = node->_dtree->insert(newAcct);
+    int success = node->_dtree->insert(std::move(newAcct));
     if(!success){return false;
     }else{return true;}
-  }else if(newAcct.getUsername() < node->getUsername()){
+  }else if(cmp < 0){
     bool inserted = insert(newAcct, node->_left);
     updateHeight(node);
     rebalance(node);
@@ -95,6 +500,25 @@ bool UTree::insert(Account newAcct, UNode *&node) {
   }
 }
 
+/**
+ * Helper for the bulk loaders.
+ * Links a UNode for an already built DTree whose username is not in the tree yet.
+ */
+void UTree::insertDTree(DTree* dtree, UNode*& node) {
+  if(node == nullptr){
+    node = _unodes.create(dtree);
+    updateHeight(node);
+    return;
+  }
+  if(dtree->getUsername() < node->_username){
+    insertDTree(dtree, node->_left);
+  }else{
+    insertDTree(dtree, node->_right);
+  }
+  updateHeight(node);
+  rebalance(node);
+}
+
 /**
  * Removes a user with a matching username and discriminator.
  * @param username username to match
@@ -102,64 +526,101 @@ bool UTree::insert(Account newAcct, UNode *&node) {
  * @param removed DNode object to hold removed account
  * @return true if an account was removed, false otherwise
  */
-bool UTree::removeUser(string username, int disc, DNode*& removed) {
-  cout << "Removing: " << username << " at disc: " << disc << endl;
-  UNode* found = retrieve(username);
+bool UTree::removeUser(std::string_view username, int disc, DNode*& removed) {
+  STATS_TIME(STATS_REMOVE);
+  if(_tracer != nullptr){
+    _tracer->logRemove(username, disc);
+  }
+  if(_journal != nullptr){
+    _journal->logRemove(username, disc);
+  }
+  bool success;
+  try{
+    success = removeAccount(username, disc, removed);
+  }catch(...){
+    if(_journal != nullptr){
+      _journal->commit(false);
+    }
+    throw;
+  }
+  if(_journal != nullptr){
+    _journal->commit(success);
+  }
+  return success;
+}
+
+bool UTree::removeAccount(std::string_view username, int disc, DNode*& removed) {
+  if(_verbose){
+    cout << "Removing: " << username << " at disc: " << disc << endl;
+  }
+  removed = nullptr;
+  UNode* found = retrieve(username, _root);
   //if no UNode with the username was found, return false.
   if(found == nullptr){return false;}
-  found->_dtree->remove(disc, removed);
   //if no DNode with the disc was removed, return false.
-  if(removed == nullptr){return false;}
-  if(numUsers(username) == 0){
-    //if all nodes in dtree are vacant, delete UNode.
-    remove(found, username);
-    updateParents(_root);
+  if(!found->_dtree->remove(disc, removed)){return false;}
+  if(found->_dtree->getNumUsers() == 0){
+    //if all nodes in dtree are vacant, delete UNode. Its DNodes go with it,
+    //so the caller gets a copy of the removed account instead.
+    _lastRemoved = DNode(removed->getAccount());
+    _lastRemoved._vacant = true;
+    removed = &_lastRemoved;
+    remove(_root, username);
+    if(_verbose){
+      cout << "UNode was removed!" << endl;
+    }
   }
   return true;
 }
 
-void UTree::updateParents(UNode* node){
-  updateParents(node->_left);
-  updateParents(node->_right);
-  updateHeight(node);
-}
-
-void UTree::remove(UNode*& node, string username){
-  UNode* nodeX;
-  if(node->_left != nullptr){
-    // find left subtree's highest value
-    nodeX = findMax(node->_left);
-    // copy its value to the node that we want to delete
-    node->_dtree = nodeX->_dtree;
-    if(nodeX->_left != nullptr){
-      nodeX->_dtree = nodeX->_left->_dtree;
-      delete nodeX->_left;
-      updateHeight(node);
-      rebalance(node);
-      cout << "UNode was removed!" << endl; //myTest print statement
-      return;
+/**
+ * Helper function for removeAccount.
+ * Deletes the UNode with the given username from the subtree, then fixes
+ * heights and balance on the way back up, so only the nodes on the search
+ * path are visited.
+ * @return true if a UNode was deleted
+**/
+bool UTree::remove(UNode*& node, std::string_view username){
+  if(node == nullptr){return false;}
+  int cmp = username.compare(node->_username);
+  if(cmp < 0){
+    if(!remove(node->_left, username)){return false;}
+  }else if(cmp > 0){
+    if(!remove(node->_right, username)){return false;}
+  }else{
+    UNode* doomed = node;
+    if(node->_left != nullptr && node->_right != nullptr){
+      //the left subtree's highest node takes the deleted node's place
+      UNode* replacement = detachMax(node->_left);
+      replacement->_left = node->_left;
+      replacement->_right = node->_right;
+      node = replacement;
+    }else{
+      node = (node->_left != nullptr ? node->_left : node->_right);
     }
+    _unodes.destroy(doomed);
+    if(node == nullptr){return true;}
   }
-  else{
-    nodeX = node;
-    if(node->_left == nullptr && node->_right != nullptr)
-      node->_dtree = node->_right->_dtree;
-    
-  }
-  delete nodeX;
-  //nodeX = nullptr;
-  cout << "UNode was removed!" << endl; //myTest print statement
   updateHeight(node);
   rebalance(node);
+  return true;
 }
 
-
-
-UNode* UTree::findMax(UNode* node){
-  if (node == nullptr || node->_right == nullptr)
-    return node;
-  else //to find max we only need to move to the right
-    return findMax(node->_right);
+/**
+ * Helper function for remove.
+ * Unlinks the highest node of the subtree and rebalances the path to it.
+ * @return the unlinked node
+**/
+UNode* UTree::detachMax(UNode*& node){
+  if(node->_right == nullptr){
+    UNode* max = node;
+    node = node->_left;
+    return max;
+  }
+  UNode* max = detachMax(node->_right);
+  updateHeight(node);
+  rebalance(node);
+  return max;
 }
 
 /**
@@ -167,35 +628,45 @@ UNode* UTree::findMax(UNode* node){
  * @param username username to match
  * @return UNode with a matching username, nullptr otherwise
  */
-UNode* UTree::retrieve(string username) {
-  UNode* node = retrieve(username, _root);
-  if(node!= nullptr){
+UNode* UTree::retrieve(std::string_view username) const {
+  STATS_TIME(STATS_RETRIEVE);
+  if(_tracer != nullptr){
+    _tracer->logRetrieve(username);
   }
-  return node;
+  return retrieve(username, _root);
 }
 
-UNode* UTree::retrieve(string username, UNode* node) {
+UNode* UTree::retrieve(std::string_view username, UNode* node) const {
   if(node != nullptr){
-    if(node->getUsername() == username){
+    STATS_COUNT(utreeComparisons);
+    int cmp = username.compare(node->_username);
+    if(cmp == 0){
+      STATS_COUNT(utreeLookups);
       return node; 
-    }else if(username < node->getUsername()){
+    }else if(cmp < 0){
       return retrieve(username, node->_left);
     }else{
       return retrieve(username, node->_right);
     }
   }
+  STATS_COUNT(utreeLookups);
   return nullptr; //return null if no match is found
 }
 
 
 
 /**
- * Retrieves the specified Account within a DNode.
+ * Retrieves the specified Account within a DNode. The node stays valid as
+ * long as one from DTree::retrieve would, and goes with its UNode.
  * @param username username to match
  * @param disc discriminator to match
  * @return DNode with a matching username and discriminator, nullptr otherwise
  */
-DNode* UTree::retrieveUser(string username, int disc) {
+DNode* UTree::retrieveUser(std::string_view username, int disc) const {
+  STATS_TIME(STATS_RETRIEVE_USER);
+  if(_tracer != nullptr){
+    _tracer->logRetrieveUser(username, disc);
+  }
   UNode* node = retrieve(username, _root);
   if(node != nullptr){
     DNode* found = node->_dtree->retrieve(disc);
@@ -210,44 +681,351 @@ DNode* UTree::retrieveUser(string username, int disc) {
  * @param username username to match
  * @return number of users with the specified username
  */
-int UTree::numUsers(string username) {
-  UNode *found = retrieve(username);
+int UTree::numUsers(std::string_view username) const {
+  STATS_TIME(STATS_NUM_USERS);
+  if(_tracer != nullptr){
+    _tracer->logNumUsers(username);
+  }
+  UNode *found = retrieve(username, _root);
+  if(found == nullptr){return 0;}
   return found->_dtree->getNumUsers();
 }
 
 /**
- * Helper for the destructor to clear dynamic memory.
+ * Lists the usernames starting with prefix in order. The descent leaves the
+ * ancestors still to be visited on a stack, so the walk stops after limit
+ * matches instead of visiting the rest of the tree.
+ * @param prefix start every username has to share, "" matches all of them
+ * @param limit most usernames to return
+ * @return matching usernames in order, with their number of users
  */
-void UTree::clear() {
-  clearTree(_root);
+std::vector<PrefixMatch> UTree::prefixScan(std::string_view prefix, int limit) const {
+  std::vector<PrefixMatch> matches;
+  std::vector<UNode*> stack;
+  for(UNode* node = _root; node != nullptr;){
+    if(std::string_view(node->_username) < prefix){
+      node = node->_right;
+    }else{
+      stack.push_back(node);
+      node = node->_left;
+    }
+  }
+  while(!stack.empty() && int(matches.size()) < limit){
+    UNode* node = stack.back();
+    stack.pop_back();
+    if(node->_username.compare(0, prefix.size(), prefix) != 0){break;}
+    matches.push_back({node->_username, node->_dtree->getNumUsers()});
+    for(node = node->_right; node != nullptr; node = node->_left){
+      stack.push_back(node);
+    }
+  }
+  return matches;
 }
-    
 
-void UTree::clearTree(UNode* node){
-  if (node == nullptr)
+/**
+ * Applies a batch of inserts and removes. The ops are put in (username,
+ * discriminator) order, keeping batch order for the same account, so every
+ * username is looked up once and its ops are applied together as a sorted
+ * run. The outcome is the same as applying the ops one at a time.
+ * @param ops the batch, in the order the changes were made
+ * @return for each op, true if it changed the tree
+**/
+std::vector<bool> UTree::applyBatch(std::vector<BatchOp> ops) {
+  std::vector<int> order(ops.size());
+  for(size_t i = 0; i < ops.size(); i++){order[i] = i;}
+  std::stable_sort(order.begin(), order.end(), [&ops](int a, int b){
+    int cmp = ops[a].account.getUsername().compare(ops[b].account.getUsername());
+    return cmp < 0 || (cmp == 0 && ops[a].account.getDiscriminator() < ops[b].account.getDiscriminator());
+  });
+
+  //the tree is only restructured once the descent is over
+  BatchState state = {ops, order, std::vector<bool>(ops.size(), false), {}, {}};
+  applyRange(_root, 0, order.size(), state);
+  for(DTree* dtree : state.added){insertDTree(dtree, _root);}
+  for(const string& username : state.emptied){remove(_root, username);}
+  return state.results;
+}
+
+/**
+ * Helper function for applyBatch.
+ * Splits the sorted ops [first, last) around node's username, applies the
+ * ones for node and hands the rest to its subtrees, so each UNode is visited
+ * at most once however many ops the batch has.
+**/
+void UTree::applyRange(UNode* node, int first, int last, BatchState& state) {
+  if(first >= last){return;}
+  const std::vector<int>& order = state.order;
+  auto username = [&state](int i) -> const string& {return state.ops[state.order[i]].account.getUsername();};
+  if(node == nullptr){
+    //usernames that are not in the tree yet
+    while(first < last){
+      int end = first + 1;
+      while(end < last && username(end) == username(first)){end++;}
+      applyRun(nullptr, order.data() + first, end - first, state);
+      first = end;
+    }
     return;
-  else{
-    clearTree(node->_left);
-    node->_dtree->clear();
-    clearTree(node->_right);
-    delete node;
+  }
+  auto byName = [&state](int op, const string& name){return state.ops[op].account.getUsername() < name;};
+  auto nameBy = [&state](const string& name, int op){return name < state.ops[op].account.getUsername();};
+  int low = std::lower_bound(order.begin() + first, order.begin() + last, node->_username, byName) - order.begin();
+  int high = std::upper_bound(order.begin() + low, order.begin() + last, node->_username, nameBy) - order.begin();
+  applyRange(node->_left, first, low, state);
+  if(low < high){applyRun(node, order.data() + low, high - low, state);}
+  applyRange(node->_right, high, last, state);
+}
+
+/**
+ * Helper function for applyBatch.
+ * Applies the ops of one username, sorted by discriminator. A run that is
+ * large next to the username's DTree is merged with the DTree's accounts and
+ * the DTree is built once from the result; a small run is applied op by op.
+**/
+void UTree::applyRun(UNode* found, const int* order, int count, BatchState& state) {
+  std::vector<BatchOp>& ops = state.ops;
+  std::vector<bool>& results = state.results;
+  const string username = ops[order[0]].account.getUsername();
+  int numUsers = (found == nullptr ? 0 : found->_dtree->getNumUsers());
+
+  if(found != nullptr && count * BATCH_REBUILD_FACTOR < numUsers){
+    for(int i = 0; i < count; i++){
+      BatchOp& op = ops[order[i]];
+      if(_journal != nullptr){
+        if(op.type == BATCH_INSERT){_journal->logInsert(op.account);}
+        else{_journal->logRemove(username, op.account.getDiscriminator());}
+      }
+      DNode* removed;
+      results[order[i]] = (op.type == BATCH_INSERT ? found->_dtree->insert(std::move(op.account))
+                                                   : found->_dtree->remove(op.account.getDiscriminator(), removed));
+      if(_journal != nullptr){_journal->commit(results[order[i]]);}
+    }
+  }else{
+    //merge the DTree's accounts with the run, following each discriminator's
+    //ops in batch order to see which succeed and what is left
+    std::vector<Account*> existing;
+    if(found != nullptr){
+      existing.reserve(numUsers);
+      found->_dtree->forEachUser([&existing](DNode* node){existing.push_back(&node->_account);});
+    }
+    std::vector<Account> merged;
+    merged.reserve(numUsers + count);
+    size_t next = 0;
+    for(int i = 0; i < count; ){
+      int disc = ops[order[i]].account.getDiscriminator();
+      for(; next < existing.size() && existing[next]->getDiscriminator() < disc; next++){
+        merged.push_back(std::move(*existing[next]));
+      }
+      Account* current = nullptr;
+      if(next < existing.size() && existing[next]->getDiscriminator() == disc){
+        current = existing[next++];
+      }
+      for(; i < count && ops[order[i]].account.getDiscriminator() == disc; i++){
+        BatchOp& op = ops[order[i]];
+        bool applied = (op.type == BATCH_INSERT) == (current == nullptr);
+        if(applied && _journal != nullptr){
+          if(op.type == BATCH_INSERT){_journal->logInsert(op.account);}
+          else{_journal->logRemove(username, disc);}
+          _journal->commit(true);
+        }
+        if(applied){current = (op.type == BATCH_INSERT ? &op.account : nullptr);}
+        results[order[i]] = applied;
+      }
+      if(current != nullptr){merged.push_back(std::move(*current));}
+    }
+    for(; next < existing.size(); next++){merged.push_back(std::move(*existing[next]));}
+
+    if(found != nullptr){
+      found->_dtree->buildFromSorted(std::move(merged));
+    }else if(!merged.empty()){
+      DTree* dtree = new DTree(&_dnodes, _balance, _compaction);
+      dtree->buildFromSorted(std::move(merged));
+      state.added.push_back(dtree);
     }
+  }
+
+  if(found != nullptr && found->_dtree->getNumUsers() == 0){
+    state.emptied.push_back(username);
+  }
+}
+
+/**
+ * Copies the tree into a FrozenUTree. Later changes to this tree are not
+ * seen by the copy, freeze again to pick them up.
+**/
+FrozenUTree UTree::freeze() const {
+  return FrozenUTree(*this);
+}
+
+/**
+ * Drops the vacant nodes of every DTree in the tree.
+ * @return number of vacant nodes dropped
+**/
+int UTree::compact() {
+  int reclaimed = 0;
+  _unodes.forEach([&reclaimed](UNode* node){reclaimed += node->_dtree->compact();});
+  return reclaimed;
+}
+
+/**
+ * Gives every DTree in this tree, and every one made later, a new balance
+ * policy. Other UTrees keep theirs.
+ * @param balance rule and ratio later inserts rebalance by
+**/
+void UTree::setBalance(const BalancePolicy& balance) {
+  _balance = balance;
+  _unodes.forEach([&balance](UNode* node){node->_dtree->setBalance(balance);});
+}
+
+/**
+ * Gives every DTree in this tree, and every one made later, a new
+ * compaction policy. Other UTrees keep theirs.
+ * @param compaction when later removes compact a DTree
+**/
+void UTree::setCompaction(const CompactPolicy& compaction) {
+  _compaction = compaction;
+  _unodes.forEach([&compaction](UNode* node){node->_dtree->setCompaction(compaction);});
+}
+
+/**
+ * Picks a discriminator no valid user with this username holds. Nothing is
+ * reserved, the caller still has to insert the account.
+ * @param username username of the new account
+ * @param policy DISC_LOWEST, DISC_RANDOM or DISC_REUSE
+ * @return a free discriminator, INVALID_DISC if the username already has
+ * every discriminator from MIN_DISC to MAX_DISC
+**/
+int UTree::allocateDiscriminator(std::string_view username, int policy) const {
+  thread_local std::mt19937 rng(std::random_device{}());
+  UNode* found = retrieve(username, _root);
+  if(found == nullptr){
+    //a new username has every discriminator free
+    return policy == DISC_RANDOM ? std::uniform_int_distribution<>(MIN_DISC, MAX_DISC)(rng) : MIN_DISC;
+  }
+  const DTree* dtree = found->_dtree;
+  if(dtree->numFree() == 0){return INVALID_DISC;}
+
+  if(policy == DISC_RANDOM){
+    return dtree->nthFree(std::uniform_int_distribution<>(0, dtree->numFree() - 1)(rng));
+  }
+  if(policy == DISC_REUSE){
+    int vacant = dtree->lowestVacant();
+    if(vacant != INVALID_DISC){return vacant;}
+  }
+  return dtree->lowestFree();
+}
+
+/**
+ * Helper for the destructor to clear dynamic memory.
+ * Every DTree draws from the shared DNode pool, so the DTrees are emptied
+ * first and both pools then hand back their blocks in one go.
+ */
+void UTree::clear() {
+  _unodes.forEach([](UNode* node){node->_dtree->forgetNodes();});
+  _dnodes.release();
+  _unodes.release();
+  _root = nullptr;
 }
 
 /**
  * Prints all accounts' details within every DTree.
  */
 void UTree::printUsers() const {
-  printUsers(_root);
+  for(const Account& acct : *this){
+    cout << '\n' << acct;
+  }
 }
 
-void UTree::printUsers(UNode *node) const {
-  if(node == nullptr){
+/**
+ * Writes every account in (username, discriminator) order to sink. Each
+ * record is formatted into one reused string and handed to the sink, which
+ * does the buffering, so nothing is flushed per record.
+ * @param sink destination, flushed at the end
+ * @param format EXPORT_CSV, EXPORT_JSON or EXPORT_SNAPSHOT
+ */
+void UTree::exportTo(ExportSink& sink, int format) const {
+  if(format == EXPORT_SNAPSHOT){
+    Snapshot::write(*this, sink);
     return;
-  }else{
-    printUsers(node->_left);
-    node->_dtree->printAccounts();
-    printUsers(node->_right);
+  }
+  if(format != EXPORT_CSV && format != EXPORT_JSON){
+    throw std::invalid_argument("exportTo: unknown format " + std::to_string(format));
+  }
+  string record;
+  for(const Account& acct : *this){
+    record.clear();
+    if(format == EXPORT_CSV){
+      appendCsv(record, acct);
+    }else{
+      appendJson(record, acct);
+    }
+    sink.write(record.data(), record.size());
+  }
+  sink.flush();
+}
+
+/**
+ * Iterator at the first account of the smallest username.
+ */
+UTree::const_iterator UTree::begin() const {
+  const_iterator it;
+  for(UNode* node = _root; node != nullptr; node = node->_left){
+    it._stack.push_back(node);
+  }
+  it.nextUNode();
+  return it;
+}
+
+/**
+ * Accounts with a username from fromUser up to but not including toUser,
+ * found with one descent to fromUser instead of a walk from the start.
+ * @param fromUser smallest username in the range, it doesn't have to exist
+ * @param toUser first username past the range
+ * @return iterators bounding the range
+ */
+UTree::Range UTree::range(std::string_view fromUser, std::string_view toUser) const {
+  Range range;
+  range.first._stop = toUser;
+  range.first._bounded = true;
+  for(UNode* node = _root; node != nullptr;){
+    if(std::string_view(node->_username) < fromUser){
+      node = node->_right;
+    }else{
+      range.first._stack.push_back(node);
+      node = node->_left;
+    }
+  }
+  range.first.nextUNode();
+  return range;
+}
+
+UTree::const_iterator& UTree::const_iterator::operator++() {
+  if(++_user == _unode->_dtree->end()){
+    nextUNode();
+  }
+  return *this;
+}
+
+/**
+ * Moves to the first account of the next username with any, ending the
+ * walk at the end of the tree or of the range.
+ */
+void UTree::const_iterator::nextUNode() {
+  _unode = nullptr;
+  while(!_stack.empty()){
+    UNode* node = _stack.back();
+    _stack.pop_back();
+    if(_bounded && node->_username >= _stop){
+      _stack.clear();
+      return;
+    }
+    for(UNode* left = node->_right; left != nullptr; left = left->_left){
+      _stack.push_back(left);
+    }
+    _user = node->_dtree->begin();
+    if(_user != node->_dtree->end()){
+      _unode = node;
+      return;
+    }
   }
 }
 
@@ -345,6 +1123,7 @@ void UTree::rebalance(UNode*& node) {
  * Performs a left rotation on the node passed in.
 **/
 UNode* UTree::leftRotation(UNode* node){
+  STATS_COUNT(rotations);
   UNode* z = node;
   UNode* y = z->_right;
   z->_right = y->_left;
@@ -359,6 +1138,7 @@ UNode* UTree::leftRotation(UNode* node){
  * Performs a right rotation on the node passed in.
 **/
 UNode* UTree::rightRotation(UNode* node){
+  STATS_COUNT(rotations);
   UNode* z = node;
   UNode* y = z->_left;
   z->_left = y->_right;
@@ -1,18 +1,51 @@
 #pragma once
 
 #include "dtree.h"
+#include <exception>
 #include <fstream>
 #include <sstream>
 
 #define DEFAULT_HEIGHT 0
 
+/* allocateDiscriminator policies */
+#define DISC_LOWEST 0       /* smallest free discriminator */
+#define DISC_RANDOM 1       /* uniformly random free discriminator */
+#define DISC_REUSE 2        /* a vacant node's, else the smallest free one */
+
+/* applyBatch operation types */
+#define BATCH_INSERT 0
+#define BATCH_REMOVE 1
+#define BATCH_REBUILD_FACTOR 4  /* a run of at least 1/4 of a DTree's users rebuilds it */
+
 class Grader;   /* For grading purposes */
 class Tester;   /* Forward declaration for testing class */
+class Journal;
+class FrozenUTree;
+class PrefixIndex;
+class ExportSink;
+class TraceRecorder;
+
+/* One change in a batch, a remove only uses the account's username and
+ * discriminator */
+struct BatchOp {
+    int type;
+    Account account;
+};
+
+/* A username found by a prefix search and its number of valid users */
+struct PrefixMatch {
+    string username;
+    int numUsers;
+};
 
 class UNode {
     friend class Grader;
     friend class Tester;
     friend class UTree;
+    friend class Snapshot;
+    friend class ShardedUTree;
+    friend class FrozenUTree;
+    friend class PrefixIndex;
 public:
     UNode() {
         _dtree = new DTree();
@@ -21,6 +54,14 @@ public:
         _right = nullptr;
     }
 
+    UNode(DTree* dtree) {
+        _dtree = dtree;
+        _username = dtree->getUsername();
+        _height = DEFAULT_HEIGHT;
+        _left = nullptr;
+        _right = nullptr;
+    }
+
     ~UNode() {
         delete _dtree;
         _dtree = nullptr;
@@ -29,10 +70,11 @@ public:
     /* Getters */
     DTree*& getDTree() {return _dtree;}
     int getHeight() const {return _height;}
-    string getUsername() const {return _dtree->getUsername();}
+    const string& getUsername() const {return _username;}
 
 private:
     DTree* _dtree;
+    string _username;   /* key cached in place so comparisons don't go through the DTree */
     int _height;
     UNode* _left;
     UNode* _right;
@@ -42,9 +84,54 @@ private:
 class UTree {
     friend class Grader;
     friend class Tester;
+    friend class Snapshot;
+    friend class ShardedUTree;
+    friend class FrozenUTree;
+    friend class PrefixIndex;
 
 public:
-    UTree():_root(nullptr){}
+    /* Forward iterator over every account in (username, discriminator)
+     * order, walking the UNodes with an explicit stack and each DTree with
+     * its own iterator. An iterator from range stops before toUser. Any
+     * change to the tree invalidates its iterators */
+    class const_iterator {
+        friend class UTree;
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef Account value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const Account* pointer;
+        typedef const Account& reference;
+
+        const_iterator(): _unode(nullptr), _bounded(false) {}
+        reference operator*() const {return *_user;}
+        pointer operator->() const {return &*_user;}
+        const_iterator& operator++();
+        const_iterator operator++(int) {const_iterator old = *this; ++*this; return old;}
+        bool operator==(const const_iterator& rhs) const {
+            return _unode == rhs._unode && (_unode == nullptr || _user == rhs._user);
+        }
+        bool operator!=(const const_iterator& rhs) const {return !(*this == rhs);}
+
+    private:
+        std::vector<UNode*> _stack;   /* UNodes still to visit */
+        UNode* _unode;                /* current username, nullptr at the end */
+        DTree::const_iterator _user;  /* current account of _unode */
+        string _stop;                 /* first username past the range */
+        bool _bounded;                /* whether _stop is set */
+
+        void nextUNode();
+    };
+
+    /* Accounts with fromUser <= username < toUser, usable in a range for */
+    struct Range {
+        const_iterator first;
+        const_iterator last;
+        const_iterator begin() const {return first;}
+        const_iterator end() const {return last;}
+    };
+
+    UTree():_root(nullptr), _journal(nullptr), _tracer(nullptr), _verbose(false){}
 
     /* destructor */
     ~UTree();
@@ -52,13 +139,43 @@ public:
     /* Basic operations */
 
     void loadData(string infile, bool append = true);
+    void loadMapped(string infile, bool append = true);
+    void loadParallel(string infile, bool append = true, int threads = 0);
+    bool saveSnapshot(string path) const;
+    void loadSnapshot(string path);
+    /* Logs every insert/removeUser that changes the tree, nullptr to stop */
+    void setJournal(Journal* journal) {_journal = journal;}
+    Journal* getJournal() const {return _journal;}
+    /* Records every public insert, removeUser, lookup and loadData call,
+     * nullptr to stop */
+    void setTracer(TraceRecorder* tracer) {_tracer = tracer;}
+    TraceRecorder* getTracer() const {return _tracer;}
+    /* Prints each removal to cout, off by default */
+    void setVerbose(bool verbose) {_verbose = verbose;}
+    /* Balance and compaction policies of every DTree in this tree */
+    void setBalance(const BalancePolicy& balance);
+    const BalancePolicy& getBalance() const {return _balance;}
+    void setCompaction(const CompactPolicy& compaction);
+    const CompactPolicy& getCompaction() const {return _compaction;}
     bool insert(Account newAcct);
-    bool removeUser(string username, int disc, DNode*& removed);
-    UNode* retrieve(string username);
-    DNode* retrieveUser(string username, int disc);
-    int numUsers(string username);
+    void buildFromSorted(std::vector<Account> sorted);
+    std::vector<bool> applyBatch(std::vector<BatchOp> ops);
+    bool removeUser(std::string_view username, int disc, DNode*& removed);
+    UNode* retrieve(std::string_view username) const;
+    DNode* retrieveUser(std::string_view username, int disc) const;
+    int numUsers(std::string_view username) const;
+    std::vector<PrefixMatch> prefixScan(std::string_view prefix, int limit) const;
+    int allocateDiscriminator(std::string_view username, int policy = DISC_LOWEST) const;
+    int compact();
+    /* Read-only copy laid out for fast lookups */
+    FrozenUTree freeze() const;
     void clear();
     void printUsers() const;
+    /* Writes every account to sink as EXPORT_CSV, EXPORT_JSON or EXPORT_SNAPSHOT */
+    void exportTo(ExportSink& sink, int format) const;
+    const_iterator begin() const;
+    const_iterator end() const {return const_iterator();}
+    Range range(std::string_view fromUser, std::string_view toUser) const;
     void dump() const {dump(_root);}
     void dump(UNode* node) const;
 
@@ -71,14 +188,40 @@ public:
 
 private:
   UNode* _root;
-  void clearTree(UNode* node);
+  NodePool<UNode> _unodes;   /* UNodes of this tree */
+  NodePool<DNode> _dnodes;   /* DNodes shared by every DTree in this tree */
+  Journal* _journal;
+  TraceRecorder* _tracer;
+  bool _verbose;
+  BalancePolicy _balance;
+  CompactPolicy _compaction;
+  DNode _lastRemoved;        /* account of the last removal that deleted its UNode */
   UNode* leftRotation(UNode* node);
   UNode* rightRotation(UNode* node);
-  UNode* retrieve(string username, UNode* node);
-  bool insert(Account newAcct, UNode *&node);
-  void remove(UNode*& node, string username);
-  UNode* findMax(UNode* node);
-  void printUsers(UNode *node) const;
+  UNode* retrieve(std::string_view username, UNode* node) const;
+  bool insert(Account& newAcct, UNode *&node);
+  void insertDTree(DTree* dtree, UNode*& node);
+  void loadAccounts(std::vector<Account>& accts, bool sorted);
+  /* Accounts one loader thread parsed from its slice of a file, and the
+   * error that stopped it, if any */
+  struct ParsedChunk {
+    std::vector<Account> accounts;
+    bool sorted = true;
+    std::exception_ptr error;
+  };
+  static std::vector<ParsedChunk> parseSlices(const char* begin, const char* end, int threads);
+  struct BatchState {
+    std::vector<BatchOp>& ops;
+    std::vector<int>& order;      /* ops in (username, discriminator) order */
+    std::vector<bool> results;
+    std::vector<DTree*> added;    /* DTrees of new usernames */
+    std::vector<string> emptied;  /* usernames the batch left without users */
+  };
+  void applyRange(UNode* node, int first, int last, BatchState& state);
+  void applyRun(UNode* found, const int* order, int count, BatchState& state);
+  UNode* fillTree(UNode** nodes, int first, int last);
+  bool removeAccount(std::string_view username, int disc, DNode*& removed);
+  bool remove(UNode*& node, std::string_view username);
+  UNode* detachMax(UNode*& node);
   int checkBalance(UNode* node);
-  void updateParents(UNode* node);
 };